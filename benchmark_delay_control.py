@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+# Command latency benchmark: round-trip time of SETs from ser.write() to the response, sustained
+# SETs per second, the time the pico spends on them and the triggers missed meanwhile.
+# Wire the test trigger GPIO_5 to GPIO_0 for the missed-trigger test (like the self-test).
+# Results can be saved with --json and compared across firmware versions and between the flash
+# and the RAM-resident build (picoPulsegen.uf2 / picoPulsegen_ram.uf2).
+from delay_control import DelayController
+import argparse
+import json
+import time
+
+# Two parameter sets of the same PIO program, SETs alternate between them
+PARAMS = ({"offset": 1000, "length": 50, "spacing": 20, "repeats": 2},
+          {"offset": 1010, "length": 50, "spacing": 20, "repeats": 2})
+
+
+def percentile(values, p):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+def round_trips(dc, sets):
+    # Round-trip time of every SET in µs
+    times = []
+    for i in range(sets):
+        start = time.perf_counter_ns()
+        dc.set_parameters(PARAMS[i % 2])
+        times.append((time.perf_counter_ns() - start) / 1000)
+    return {"p50_us": percentile(times, 50), "p99_us": percentile(times, 99), "max_us": max(times)}
+
+
+def sustained_rate(dc, sets, pipelined):
+    # SETs per second, pipelined with up to 8 frames in flight
+    start = time.perf_counter()
+    if pipelined:
+        futures = [dc.set_parameters(PARAMS[i % 2], wait=False) for i in range(sets)]
+        for future in futures:
+            future.result()
+    else:
+        for i in range(sets):
+            dc.set_parameters(PARAMS[i % 2])
+    return sets / (time.perf_counter() - start)
+
+
+def missed_triggers(dc, sets, trigger_hz):
+    # Triggers dropped while SETs arrive, minus those dropped in the same time without SETs
+    # (train and cooldown of PARAMS are far shorter than the trigger period)
+    dc.set_parameters(PARAMS[0])
+    dc.set_stimulus(trigger_hz)
+    try:
+        before = dc.get_stats()
+        start = time.perf_counter()
+        for i in range(sets):
+            dc.set_parameters(PARAMS[i % 2])
+        duration = time.perf_counter() - start
+        during = dc.get_stats()
+        time.sleep(duration)
+        after = dc.get_stats()
+    finally:
+        dc.stop_stimulus()
+    dropped = (during["dropped"] - before["dropped"]) % 2**32
+    baseline = (after["dropped"] - during["dropped"]) % 2**32
+    return {"triggers": (during["triggers"] - before["triggers"]) % 2**32,
+            "dropped": dropped, "dropped_without_sets": baseline}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark the command latency of the Pico pulse generator')
+    parser.add_argument('--port', default='/dev/ttyACM0', help='Serial port')
+    parser.add_argument('--baudrate', type=int, default=115200,
+                        help='Baud rate of the hardware UART transport (e.g. 3000000, ignored over USB)')
+    parser.add_argument('--sets', type=int, default=1000, help='SETs per measurement')
+    parser.add_argument('--ascii-sets', type=int, default=20,
+                        help='SETs per measurement of the ASCII parser (each waits for its 100 ms timeout)')
+    parser.add_argument('--trigger-hz', type=float, default=10000,
+                        help='Stimulus frequency of the missed-trigger test (0 = skip the test)')
+    parser.add_argument('--json', metavar='FILE', help='Also write the results to FILE')
+    args = parser.parse_args()
+
+    results = {}
+    with DelayController(port=args.port, baudrate=args.baudrate, binary=True) as dc:
+        results["ram_resident"] = dc.runs_from_ram()
+    print(f"Firmware runs from {'RAM' if results['ram_resident'] else 'flash'}")
+    low_latency = args.baudrate != 115200
+    for name, options in (("ascii", {}), ("binary", {"binary": True}), ("pipelined", {"pipelined": True})):
+        with DelayController(port=args.port, baudrate=args.baudrate, low_latency=low_latency, **options) as dc:
+            dc.get_latency_stats(reset=True)
+            sets = args.ascii_sets if name == "ascii" else args.sets
+            result = {"round_trip": round_trips(dc, sets),
+                      "sets_per_s": sustained_rate(dc, sets, name == "pipelined"),
+                      "device": dc.get_latency_stats(reset=True)}
+            if name == "binary" and args.trigger_hz:
+                result["missed_triggers"] = missed_triggers(dc, args.sets, args.trigger_hz)
+            results[name] = result
+
+            rt = result["round_trip"]
+            print(f"{name}: round trip p50 {rt['p50_us']:.0f} us, p99 {rt['p99_us']:.0f} us, "
+                  f"max {rt['max_us']:.0f} us, {result['sets_per_s']:.0f} SETs/s")
+            for kind, stats in result["device"].items():
+                print(f"  {kind} on the pico: mean {stats['mean']} ns, min {stats['min']} ns, "
+                      f"max {stats['max']} ns ({stats['count']} SETs)")
+            if "missed_triggers" in result:
+                missed = result["missed_triggers"]
+                print(f"  dropped {missed['dropped']} of {missed['triggers']} triggers during the SETs, "
+                      f"{missed['dropped_without_sets']} without")
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
+
+
+if __name__ == "__main__":
+    main()
@@ -3,10 +3,242 @@ import serial
 import struct
 import time
 import argparse
+import binascii
+import collections
+import concurrent.futures
+import queue
+import threading
+
+# Binary frame protocol (see handle_frame() in main.c)
+FRAME_SYNC = 0xA5
+FRAME_SYNC_TAGGED = 0xA6 # Followed by a tag byte the response repeats (see FramePipeline)
+FRAME_OP_GET = 0x01
+FRAME_OP_SET = 0x02
+FRAME_OP_GET_CHANNEL = 0x03
+FRAME_OP_SET_CHANNEL = 0x04
+FRAME_OP_SWEEP_LOAD = 0x10
+FRAME_OP_SWEEP_GRID = 0x11
+FRAME_OP_SWEEP_START = 0x12
+FRAME_OP_SWEEP_STOP = 0x13
+FRAME_OP_SWEEP_RANDOM = 0x14
+FRAME_OP_PRESET = 0x15
+FRAME_OP_SCHEDULE = 0x20
+FRAME_OP_BURST = 0x21
+FRAME_OP_CLOCK = 0x30
+FRAME_OP_CLOCK_EXT = 0x31
+FRAME_OP_SELFTEST = 0x40
+FRAME_OP_STIMULUS = 0x50
+FRAME_OP_QUALIFIER = 0x60
+FRAME_OP_ARM = 0x70
+FRAME_OP_FIRED = 0x71 # Sent by the pico on its own once an armed shot fired
+FRAME_OP_CLOCK_LOST = 0x32 # Sent by the pico on its own when the target clock stopped
+FRAME_OP_SAVE = 0x80
+FRAME_OP_LATENCY = 0x90
+
+SWEEP_MAX_POINTS = 8192
+SWEEP_POINTS_PER_FRAME = 20 # 2 + 20 * 12 payload bytes fit into one frame
+SCHEDULE_MAX_PULSES = 30
+BURST_MAX_OFFSETS = 30
+SELFTEST_MAX_SHOTS = 100000
+SELFTEST_HIST_BINS = 16
+SELFTEST_SHOT_TIMEOUT_S = 0.1
+STIMULUS_MIN_CYCLES = 3
+STIMULUS_MAX_CYCLES = 2**31 + 2
+STIMULUS_PATTERN_MAX_PULSES = 30
+STIMULUS_MAX_PULSES = 1024 # Pulses of the pattern times its repeats
+QUALIFIER_MAX_WIDTH = 33
+PATTERN_MAX_BITS = 32
+PATTERN_MIN_PERIOD = 4 # Cycles between two samples of the pattern trigger
+PATTERN_MAX_PERIOD = 4 * 65535
+PRESET_COUNT = 8
+PRESET_SELECT_BYTE = 0x80 # Single-byte preset switch: 0x80 + preset, echoed by the pico
+
+# Campaign log file (see CampaignLog): header, then one record per shot
+CAMPAIGN_MAGIC = b"PPGLOG\0\0"
+CAMPAIGN_VERSION = 1
+CAMPAIGN_HEADER = struct.Struct("<8sIIQ40x") # magic, version, record size, clock in Hz
+CAMPAIGN_RECORD = struct.Struct("<qqIIIIIHH") # see CAMPAIGN_FIELDS
+CAMPAIGN_FIELDS = [("host_arm_ns", "<i8"), ("host_fired_ns", "<i8"), ("seq", "<u4"), ("device_us", "<u4"),
+                   ("triggers", "<u4"), ("offset", "<u4"), ("spacing", "<u4"), ("length", "<u2"),
+                   ("repeats", "<u2")]
+CAMPAIGN_FLUSH_SHOTS = 256
+PIPELINE_MAX_IN_FLIGHT = 8 # Tagged frames sent before the first response (fit into the receive buffer of the pico)
+
+FRAME_STATUS = {
+    0x00: "OK",
+    0x01: "crc_error",
+    0x02: "length_error",
+    0x03: "unknown_opcode",
+    0x04: "unknown_param",
+    0x05: "out_of_range",
+    0x06: "timeout",
+    0x07: "sweep_too_large",
+    0x08: "not_available_in_current_mode",
+    0x09: "unknown_channel",
+    0x0A: "flash_write_failed",
+}
+
+
+def crc16(data: bytes) -> int:
+    # CRC-16/CCITT-FALSE, same as crc16_ccitt() in main.c
+    return binascii.crc_hqx(data, 0xFFFF)
+
+
+def frame_error(status, data):
+    detail = f" ('{chr(data[0])}')" if data else ""
+    return RuntimeError(f"Pico rejected frame: {FRAME_STATUS.get(status, hex(status))}{detail}")
+
+
+class FramePipeline:
+    # Background transport of DelayController(pipelined=True): frames are sent tagged
+    # (FRAME_SYNC_TAGGED) without waiting for the responses before, a reader thread resolves the
+    # future of each response by its tag. Up to PIPELINE_MAX_IN_FLIGHT frames are in flight.
+    # FIRED notifications go to dc.fired, CLOCK_LOST ones to dc._clock_lost(), single bytes
+    # (preset switch echoes) to `echoes`.
+    # The tag of a timed out frame is not handed out again before its late response (or the
+    # response to a later frame) arrived, so a late response cannot resolve another frame.
+    def __init__(self, dc):
+        self.dc = dc
+        self.lock = threading.Lock()
+        self.pending = {} # tag -> future
+        # Tags of timed out frames -> send order, reserved until their late response arrives
+        # (or a response to a later frame, the pico answers in order)
+        self.stale = {}
+        self.sent = 0 # Frames sent
+        self.next_tag = 0
+        self.slots = threading.BoundedSemaphore(PIPELINE_MAX_IN_FLIGHT)
+        self.fired_cond = threading.Condition()
+        self.echoes = queue.Queue()
+        self.running = True
+        self.thread = threading.Thread(target=self._reader, daemon=True)
+        self.thread.start()
+
+    def close(self):
+        self.running = False
+        self.thread.join()
+
+    def submit(self, frames):
+        # Sends [(opcode, payload), ...] with a single write (one USB packet for up to 64 bytes),
+        # returns a future per frame that resolves to the response data or raises RuntimeError
+        futures = []
+        data = b""
+        for opcode, payload in frames:
+            if not self.slots.acquire(blocking=False):
+                self.dc.ser.write(data) # The responses to these free the slots
+                data = b""
+                self.slots.acquire()
+            future = concurrent.futures.Future()
+            future.add_done_callback(lambda _: self.slots.release())
+            with self.lock:
+                if len(self.pending) + len(self.stale) >= 256:
+                    self.slots.release()
+                    self.dc.ser.write(data)
+                    raise RuntimeError("No free frame tag, 256 responses are outstanding")
+                while self.next_tag in self.pending or self.next_tag in self.stale:
+                    self.next_tag = (self.next_tag + 1) % 256
+                tag = self.next_tag
+                self.next_tag = (tag + 1) % 256
+                self.pending[tag] = (future, self.sent)
+                self.sent += 1
+            body = bytes([tag, len(payload) + 1, opcode]) + payload
+            data += bytes([FRAME_SYNC_TAGGED]) + body + struct.pack("<H", crc16(body))
+            futures.append(future)
+        self.dc.ser.write(data)
+        return futures
+
+    def result(self, future, timeout):
+        try:
+            return future.result(timeout)
+        except concurrent.futures.TimeoutError:
+            with self.lock:
+                for tag, (pending, order) in list(self.pending.items()):
+                    if pending is future:
+                        # A late response must not resolve the next frame with this tag
+                        del self.pending[tag]
+                        self.stale[tag] = order
+            future.cancel()
+            raise RuntimeError("No response frame within the timeout") from None
+
+    def _read(self, length):
+        data = b""
+        while self.running and len(data) < length:
+            data += self.dc.ser.read(length - len(data))
+        return data
+
+    def _reader(self):
+        while self.running:
+            sync = self.dc.ser.read(1)
+            if not sync:
+                continue
+            if sync[0] not in (FRAME_SYNC, FRAME_SYNC_TAGGED):
+                self.echoes.put(sync)
+                continue
+            tagged = sync[0] == FRAME_SYNC_TAGGED
+            header = self._read(2 if tagged else 1)
+            rest = self._read(header[-1] + 2)
+            if len(rest) != header[-1] + 2 or struct.unpack("<H", rest[-2:])[0] != crc16(header + rest[:-2]):
+                self.dc.ser.reset_input_buffer() # Lost sync, the affected frames time out
+                continue
+            opcode, status, data = rest[0], rest[1], rest[2:-2]
+            if not tagged:
+                if opcode == FRAME_OP_FIRED:
+                    with self.fired_cond:
+                        self.dc.fired.append(struct.unpack("<III", data))
+                        self.fired_cond.notify_all()
+                elif opcode == FRAME_OP_CLOCK_LOST:
+                    self.dc._clock_lost(*struct.unpack("<II", data))
+                continue # An untagged error frame has lost its tag, that frame times out
+            with self.lock:
+                if header[0] in self.stale: # Late response of a timed out frame
+                    order = self.stale.pop(header[0])
+                    future = None
+                else:
+                    future, order = self.pending.pop(header[0], (None, None))
+                if order is not None: # Timed out frames sent before this one are not answered any more
+                    self.stale = {tag: sent for tag, sent in self.stale.items() if sent > order}
+            if future is None or not future.set_running_or_notify_cancel():
+                continue
+            if status != 0:
+                future.set_exception(frame_error(status, data))
+            else:
+                future.set_result(data)
+
+
+def random_sweep_offset(seed, index, offset_min, offset_count):
+    # Offset (cycles) of point `index` of a random sweep, same as random_offset() in main.c
+    x = (seed + (index + 1) * 0x9E3779B9) & 0xFFFFFFFF
+    x ^= x >> 16
+    x = (x * 0x7FEB352D) & 0xFFFFFFFF
+    x ^= x >> 15
+    x = (x * 0x846CA68B) & 0xFFFFFFFF
+    x ^= x >> 16
+    return offset_min + ((x * offset_count) >> 32)
+
 
 class DelayController:
-    def __init__(self, port='/dev/ttyACM0', baudrate=115200):
+    # The baudrate only matters for the hardware UART transport (ENABLE_COMMAND_UART in main.c,
+    # e.g. port='/dev/ttyUSB0', baudrate=3000000). low_latency asks the serial driver to pass
+    # received bytes on right away (FTDI adapters otherwise wait up to 16 ms).
+    # pipelined keeps several binary frames in flight (see FramePipeline, implies binary).
+    def __init__(self, port='/dev/ttyACM0', baudrate=115200, binary=False, low_latency=False, pipelined=False):
         self.ser = serial.Serial(port, baudrate, timeout=1)
+        if low_latency:
+            self.ser.set_low_latency_mode(True)
+        # Use framed binary commands instead of the ASCII commands (no parser timeouts on the Pico)
+        self.binary = binary or pipelined
+        # System clock of the pico in Hz, read on first use (see get_clock())
+        self.clock_hz = None
+        # Bit fields of the combined word, read on first use (see get_field_widths())
+        self.field_widths = None
+        # (sequence number, fire timestamp in µs, trigger count) of fired shots the pico reported
+        # between responses (see wait_fired_report())
+        self.fired = collections.deque()
+        # Fallbacks to the internal clock the pico reported (CLOCK_LOST), the triggers are held
+        # until set_clock() or set_external_clock() (see clock_task() in main.c)
+        self.clock_losses = 0
+        # (seed, smallest offset, number of offsets) in cycles of the last random sweep
+        self.random_sweep = None
+        self.pipeline = FramePipeline(self) if pipelined else None
 
     def __enter__(self):
         return self
@@ -15,83 +247,778 @@ class DelayController:
         self.close()
 
     def close(self):
+        if self.pipeline:
+            self.pipeline.close()
         self.ser.close()
 
 
-    # Since pico expects paramets in clock cylces and one clock cycle = 5ns
-    # Divide incoming ns values by 5
+    # Since pico expects paramets in clock cylces, "time" parameters are given in ns and
+    # converted with the clock period the pico reports (5 ns at its boot clock of 200 MHz)
+    # Ranges are in cycles: limits of the most permissive PIO program, the pico checks the
+    # limits of the program it picks for the parameters (single pulse, train, schedule, burst)
+    # Length and repeats are limited by the bit fields of the combined word, which depend on the
+    # firmware build and are read from the pico (see _param_range(), defaults given here)
+    # The spacing of trains and bursts on channel 0 is counted in steps of `multiplier`
+    # cycles (rounded down by the pico, see get_spacing_step())
     param_constraints = {
-        "offset":  {"range": (2 * 5, (2**32 - 1) * 5), "divider": 5},
-        "length":  {"range": (1 * 5, (2**7 - 1) * 5),  "divider": 5},
-        "spacing": {"range": (6 * 6, (2**20 - 1) * 5),  "divider": 5},
-        "repeats": {"range": (0, 31),   "divider": 1},
+        "offset":  {"range": (2, 2**32 - 1), "time": True},
+        "length":  {"range": (1, 2**7),      "time": True},
+        "spacing": {"range": (0, 2**32 - 1), "time": True},
+        "repeats": {"range": (0, 31),        "time": False},
+        "cooldown": {"range": (0, 2**32 - 1), "time": True},
+        "multiplier": {"range": (1, 16),     "time": False},
     }
 
-    def set_parameters(self, parameters: dict):
-        uart_string = "S "
-        for key, value in parameters.items():
-            # Verify parameter name
-            if key not in self.param_constraints:
-                raise ValueError(f"Invalid parameter: '{key}'")
+    def _time_to_cycles(self, ns):
+        # Times are rounded to the nearest clock cycle
+        clock_hz = self.clock_hz or self.get_clock()
+        return (ns * clock_hz + 500_000_000) // 1_000_000_000
+
+    def _cycles_to_ns(self, cycles):
+        clock_hz = self.clock_hz or self.get_clock()
+        ns = cycles * 1_000_000_000 / clock_hz
+        return int(ns) if ns.is_integer() else ns
+
+    def _ns_to_cycles(self, key, value):
+        # Converts the value of parameter `key` if it is a time
+        return self._time_to_cycles(value) if self.param_constraints[key]["time"] else value
+
+    def _to_ns(self, key, cycles):
+        return self._cycles_to_ns(cycles) if self.param_constraints[key]["time"] else cycles
+
+    def _to_cycles(self, key, value):
+        # Verify parameter name
+        if key not in self.param_constraints:
+            raise ValueError(f"Invalid parameter: '{key}'")
+
+        # Verify parameter type (int)
+        if not isinstance(value, int):
+            raise ValueError(f"Value for '{key}' must be an integer.")
+
+        # Verify parameter range (in cycles)
+        cycles = self._ns_to_cycles(key, value)
+        min_val, max_val = self._param_range(key)
+        if not (min_val <= cycles <= max_val):
+            raise ValueError(f"Value for '{key}'={value} is out of valid range "
+                             f"{(self._to_ns(key, min_val), self._to_ns(key, max_val))}.")
+
+        return cycles
 
-            # Get parameter constraints
-            constraint = self.param_constraints[key]
-            value_range = constraint["range"]
-            divider = constraint["divider"]
+    def get_field_widths(self):
+        # Bits of the repeats, length and spacing fields of the combined word (PULSEGEN_*_BITS
+        # of the firmware build), read on first use
+        if self.field_widths is None:
+            value = self._get_status("z")
+            self.field_widths = {"repeats": value & 0xFF, "length": (value >> 8) & 0xFF, "spacing": value >> 16}
+        return self.field_widths
 
-            # Verify parameter type (int)
-            if not isinstance(value, int):
-                raise ValueError(f"Value for '{key}' must be an integer.")
+    def runs_from_ram(self):
+        # Whether the pico runs the RAM-resident build (picoPulsegen_ram.uf2)
+        return bool(self._get_status("g"))
 
-            # Verify parameter range
-            if value_range:
-                min_val, max_val = value_range
-                if not (min_val <= value <= max_val):
-                    raise ValueError(f"Value for '{key}'={value} is out of valid range {value_range}.")
-            if divider and value % divider != 0:
-                raise ValueError(f"Value for '{key}'={value} must be divisible by {divider}.")
+    def _param_range(self, key):
+        if key == "length":
+            return 1, 2**self.get_field_widths()["length"] # Length loop count + 1
+        if key == "repeats":
+            return 0, 2**self.get_field_widths()["repeats"] - 1
+        return self.param_constraints[key]["range"]
 
-            divided_value = value // divider # Calculate clock cycles from ns inputs
+    def _readline(self):
+        # Next ASCII response line, FIRED notifications in between are queued for wait_fired(),
+        # CLOCK_LOST notifications drop the cached clock
+        while True:
+            line = self.ser.readline().decode().strip()
+            if line.startswith("FIRED "):
+                self._queue_fired_line(line)
+            elif line.startswith("CLOCK_LOST "):
+                self._clock_lost(*(int(field) for field in line.split()[1:3]))
+            else:
+                return line
+
+    def _queue_fired_line(self, line):
+        # FIRED <seq> <us> <triggers>
+        self.fired.append(tuple(int(field) for field in line.split()[1:4]))
+
+    def _read_frame(self, start=b""):
+        # Frame: SYNC, LEN, opcode, status, data, CRC. Returns (opcode, status, data), None on timeout.
+        # `start` are the bytes of the frame that were read already.
+        header = start + self.ser.read(2 - len(start))
+        if not header:
+            return None
+        if len(header) != 2 or header[0] != FRAME_SYNC:
+            self.ser.reset_input_buffer()
+            raise RuntimeError(f"No valid response frame (received {header!r})")
+        rest = self.ser.read(header[1] + 2)
+        if len(rest) != header[1] + 2 or header[1] < 2:
+            raise RuntimeError(f"Truncated response frame (received {header + rest!r})")
+        (crc,) = struct.unpack("<H", rest[-2:])
+        if crc != crc16(header[1:] + rest[:-2]):
+            raise RuntimeError("CRC mismatch in response frame")
+        return rest[0], rest[1], rest[2:-2]
+
+    def _clock_lost(self, losses, clock_hz):
+        # The pico fell back to its internal clock (clock_hz): parameters in ns have to be
+        # converted again, the clock is read on next use
+        self.clock_hz = None
+        self.clock_losses = losses
+
+    def _read_notification_frame(self, frame):
+        # Handles a FRAME_OP_FIRED or FRAME_OP_CLOCK_LOST frame, returns False for other frames
+        if frame is not None and frame[0] == FRAME_OP_FIRED:
+            self.fired.append(struct.unpack("<III", frame[2]))
+            return True
+        if frame is not None and frame[0] == FRAME_OP_CLOCK_LOST:
+            self._clock_lost(*struct.unpack("<II", frame[2]))
+            return True
+        return False
+
+    def _transceive_frame(self, opcode, payload=b"", timeout=None):
+        # Response data of one frame, `timeout` overrides the timeout of the port
+        return self._transceive_frames([(opcode, payload)], timeout)[0]
+
+    def _transceive_frames(self, frames, timeout=None):
+        # Sends [(opcode, payload), ...] in one write and returns the data of every response,
+        # the first rejected frame raises RuntimeError once all responses were received
+        timeout = timeout or self.ser.timeout
+        if self.pipeline:
+            futures = self.pipeline.submit(frames)
+            return [self.pipeline.result(future, timeout) for future in futures]
+
+        data = b""
+        for opcode, payload in frames:
+            body = bytes([len(payload) + 1, opcode]) + payload
+            data += bytes([FRAME_SYNC]) + body + struct.pack("<H", crc16(body))
+        saved_timeout = self.ser.timeout
+        self.ser.timeout = timeout
+        try:
+            self.ser.write(data)
+            frames = [self._read_response_frame() for _ in frames]
+        finally:
+            self.ser.timeout = saved_timeout
+        for _, status, data in frames:
+            if status != 0:
+                raise frame_error(status, data)
+        return [data for _, _, data in frames]
+
+    def _read_response_frame(self):
+        frame = self._read_frame()
+        while self._read_notification_frame(frame):
+            frame = self._read_frame()
+        if frame is None:
+            raise RuntimeError("No valid response frame (received b'')")
+        return frame
+
+    # Channel 0 is the main output (sweep, schedule and burst mode), further channels are
+    # additional outputs sharing the trigger (see NUM_CHANNELS in main.c)
+    #
+    # With pipelined=True, set_parameters(..., wait=False) returns a future instead of waiting
+    # for the acknowledgement (its result() raises RuntimeError if the pico rejected the set).
+    def set_parameters(self, parameters: dict, channel=0, wait=True):
+        if self.binary:
+            frame = self._set_frame(parameters, channel)
+            if not wait:
+                if not self.pipeline:
+                    raise RuntimeError("wait=False needs DelayController(pipelined=True)")
+                return self.pipeline.submit([frame])[0]
+            self._transceive_frame(*frame)
+            return
+
+        uart_string = f"S{channel if channel else ''} "
+        for key, value in parameters.items():
+            divided_value = self._to_cycles(key, value)
             uart_string += f"{key[0]} {divided_value} "
 
         self.ser.write(uart_string.encode('ascii'))
-        response = self.ser.readline().decode().strip()
+        response = self._readline()
 
         if response != "OK":
             raise RuntimeError(f"Setting Pico parameters: '{response}' on command: '{uart_string}'")
 
-    def get_parameter(self, key):
+    def _set_frame(self, parameters, channel):
+        payload = b"".join(struct.pack("<BI", ord(key[0]), self._to_cycles(key, value))
+                           for key, value in parameters.items())
+        if channel:
+            return FRAME_OP_SET_CHANNEL, bytes([channel]) + payload
+        return FRAME_OP_SET, payload
+
+    def set_many(self, settings: dict):
+        # Sets the parameters of several channels ({channel: {key: ns}}) with a single write
+        # (one USB packet for two channels of four parameters), the pico applies them in order
+        self._transceive_frames([self._set_frame(parameters, channel) for channel, parameters in settings.items()])
+
+    def get_all(self, channels=(0,)):
+        # All parameters of the given channels in ns ({channel: {key: ns}}), one write and a
+        # single GET frame per channel
+        keys = bytes(ord(key[0]) for key in self.param_constraints)
+        frames = [(FRAME_OP_GET_CHANNEL, bytes([channel]) + keys) if channel else (FRAME_OP_GET, keys)
+                  for channel in channels]
+        result = {}
+        for channel, data in zip(channels, self._transceive_frames(frames)):
+            values = struct.unpack(f"<{len(keys)}I", data)
+            result[channel] = {key: self._to_ns(key, value) for key, value in zip(self.param_constraints, values)}
+        return result
+
+    def get_parameters(self, keys, channel=0):
+        # Read several parameters with a single binary frame (returns dict of ns values)
+        for key in keys:
+            if key not in self.param_constraints:
+                raise ValueError(f"Invalid parameter: '{key}'")
+        payload = bytes(ord(key[0]) for key in keys)
+        if channel:
+            data = self._transceive_frame(FRAME_OP_GET_CHANNEL, bytes([channel]) + payload)
+        else:
+            data = self._transceive_frame(FRAME_OP_GET, payload)
+        raw = struct.unpack(f"<{len(keys)}I", data)
+        return {key: self._to_ns(key, value) for key, value in zip(keys, raw)}
+
+    def get_parameter(self, key, channel=0):
         # Veriy parameter name
         if key not in self.param_constraints:
             raise ValueError(f"Invalid parameter: '{key}'")
 
-        # Get parameter constraints
-        divider = self.param_constraints[key]["divider"]
-        uart_string = f"G {key[0]}"
+        if self.binary:
+            return self.get_parameters([key], channel)[key]
+
+        uart_string = f"G{channel if channel else ''} {key[0]}"
         self.ser.write(uart_string.encode('ascii'))
-        response = self.ser.readline().decode().strip()
+        response = self._readline()
 
         # Convert parameter value to number
         try:
             raw = int(response)
         except ValueError:
-            print(f"Error: Unexpected response '{response}' for parameter '{key}'")
-            return -1
+            raise RuntimeError(f"Unexpected response '{response}' for parameter '{key}'") from None
+
+        # Return paramter in ns (cycles times the clock period)
+        return self._to_ns(key, raw)
+
+    def _get_status(self, key, channel=0):
+        # Read a status value of channel 0 (see get_value() in main.c), counters also of other channels
+        if self.binary:
+            if channel:
+                data = self._transceive_frame(FRAME_OP_GET_CHANNEL, bytes([channel]) + key.encode('ascii'))
+            else:
+                data = self._transceive_frame(FRAME_OP_GET, key.encode('ascii'))
+            (value,) = struct.unpack("<I", data)
+            return value
+        self.ser.write(f"G{channel if channel else ''} {key}".encode('ascii'))
+        return int(self._readline())
+
+    def get_stats(self, channel=0):
+        # Counters since boot (wrap at 2^32, compare two readings for rates): trigger edges,
+        # triggers served by the channel, triggers it dropped (during a train, its cooldown or
+        # while the trigger was still high) and late sweep refills of channel 0
+        served = self._get_status("v", channel)
+        triggers = self._get_status("t")
+        return {
+            "triggers": triggers,
+            "served": served,
+            "dropped": (triggers - served) % 2**32,
+            "sweep_underruns": self._get_status("w"),
+        }
+
+    def get_clock(self):
+        # System clock of the pico in Hz, all times are counted in its cycles
+        self.clock_hz = self._get_status("f")
+        return self.clock_hz
+
+    def get_resolution(self):
+        # Clock period in ns (timing resolution of offset, length, spacing and cooldown)
+        return self._cycles_to_ns(1)
+
+    def set_clock(self, khz):
+        # Switch the system clock of the pico (e.g. 250000 kHz, 48-300 MHz). Parameters are
+        # kept in cycles on the pico, so they have to be set again to keep their times in ns.
+        if self.binary:
+            (self.clock_hz,) = struct.unpack("<I", self._transceive_frame(FRAME_OP_CLOCK, struct.pack("<I", khz)))
+            return self.clock_hz
+        self.ser.write(f"C {khz}".encode('ascii'))
+        response = self._readline()
+        if response != "OK":
+            raise RuntimeError(f"Setting Pico clock: '{response}'")
+        return self.get_clock()
+
+    def set_external_clock(self, khz):
+        # Clock the pico from the target clock at GPIO_20 (khz = its frequency, 48-50 MHz over
+        # USB, 28.8-50 MHz with the UART transport): all
+        # parameters are then counted in target clock cycles, set_parameters() in ns uses the
+        # target's period. set_clock() returns to the internal clock.
+        if self.binary:
+            (self.clock_hz,) = struct.unpack("<I", self._transceive_frame(FRAME_OP_CLOCK_EXT, struct.pack("<I", khz)))
+            return self.clock_hz
+        self.ser.write(f"X {khz}".encode('ascii'))
+        response = self._readline()
+        if response != "OK":
+            raise RuntimeError(f"External clock (check the frequency and GPIO_20): '{response}'")
+        return self.get_clock()
+
+    def get_clock_source(self):
+        # Whether the pico runs from the target clock, and how often it fell back to the
+        # internal clock because the target clock stopped (each fallback holds the triggers
+        # until the next set_clock() / set_external_clock())
+        return {"external": bool(self._get_status("x")), "losses": self._get_status("y")}
+
+    def get_spacing_step(self):
+        # Step of the spacing of channel 0 in ns (clock period times the multiplier in effect,
+        # the multiplier only applies to trains and bursts). get_parameter("spacing") returns
+        # the spacing rounded down to this step.
+        return self._cycles_to_ns(self._get_status("u"))
+
+    # Sweep mode: every trigger uses the next point of a table on the pico.
+    # Points are dicts with the four parameters in ns (like set_parameters()).
+    def load_sweep(self, points, start_index=0):
+        if start_index + len(points) > SWEEP_MAX_POINTS:
+            raise ValueError(f"Sweep exceeds {SWEEP_MAX_POINTS} points.")
+        for i in range(0, len(points), SWEEP_POINTS_PER_FRAME):
+            payload = struct.pack("<H", start_index + i)
+            for point in points[i:i + SWEEP_POINTS_PER_FRAME]:
+                payload += struct.pack("<IIHH",
+                                       self._to_cycles("offset", point["offset"]),
+                                       self._to_cycles("spacing", point["spacing"]),
+                                       self._to_cycles("length", point["length"]),
+                                       self._to_cycles("repeats", point["repeats"]))
+            self._transceive_frame(FRAME_OP_SWEEP_LOAD, payload)
+
+    def generate_sweep_grid(self, offsets, lengths, repeats=(0, 0, 1)):
+        # Let the pico build an offset x length x repeats grid (each given as (start, step, count),
+        # offset/length in ns). The offset changes fastest, spacing is the currently set one.
+        # Returns the number of points.
+        def cycles(key, start, step, count):
+            if not isinstance(step, int) or step < 0:
+                raise ValueError(f"Step for '{key}'={step} must be a positive integer.")
+            return self._to_cycles(key, start), self._ns_to_cycles(key, step), count
+        payload = struct.pack("<IIH", *cycles("offset", *offsets))
+        payload += struct.pack("<HHH", *cycles("length", *lengths))
+        payload += struct.pack("<HHH", *cycles("repeats", *repeats))
+        (points,) = struct.unpack("<I", self._transceive_frame(FRAME_OP_SWEEP_GRID, payload))
+        return points
+
+    def start_sweep(self, num_points):
+        self._transceive_frame(FRAME_OP_SWEEP_START, struct.pack("<I", num_points))
+
+    def stop_sweep(self):
+        self._transceive_frame(FRAME_OP_SWEEP_STOP)
+
+    def start_random_sweep(self, seed, offset_min, offset_max):
+        # Every trigger uses a random offset of [offset_min, offset_max] ns drawn on the pico,
+        # the other parameters are the currently set ones. Stopped with stop_sweep() or a SET.
+        cycles_min = self._to_cycles("offset", offset_min)
+        cycles_max = self._to_cycles("offset", offset_max)
+        if cycles_max < cycles_min:
+            raise ValueError("offset_max must not be below offset_min.")
+        seed &= 0xFFFFFFFF
+        self._transceive_frame(FRAME_OP_SWEEP_RANDOM, struct.pack("<III", seed, cycles_min, cycles_max))
+        self.random_sweep = (seed, cycles_min, cycles_max - cycles_min + 1)
+
+    def get_random_offset(self, index):
+        # Offset in ns the n-th trigger (counting from 0) of the last random sweep used, e.g.
+        # with the index of get_sweep_index() after a shot
+        if self.random_sweep is None:
+            raise RuntimeError("No random sweep started.")
+        return self._to_ns("offset", random_sweep_offset(self.random_sweep[0], index, *self.random_sweep[1:]))
+
+    def get_sweep_index(self):
+        # Returns (table index of the point armed for the next trigger, points used since start)
+        data = self._transceive_frame(FRAME_OP_GET, b"in")
+        return struct.unpack("<II", data)
+
+    # Preset bank of channel 0: store_preset() saves the current parameters, select_preset()
+    # switches back to them with a single byte (no parser timeout, also in ASCII mode). With
+    # set_preset_gpio(True) the select inputs GPIO_9-11 pick the preset instead, SETs of
+    # channel 0 are rejected until set_preset_gpio(False).
+    def _preset_command(self, key, value):
+        if self.binary:
+            self._transceive_frame(FRAME_OP_PRESET, struct.pack("<BI", ord(key), value))
+            return
+        self.ser.write(f"P {key} {value}".encode('ascii'))
+        response = self._readline()
+        if response != "OK":
+            raise RuntimeError(f"Preset command '{key} {value}': '{response}'")
+
+    def store_preset(self, index):
+        if not 0 <= index < PRESET_COUNT:
+            raise ValueError(f"Preset must be 0-{PRESET_COUNT - 1}.")
+        self._preset_command("s", index)
+
+    def select_preset(self, index):
+        if not 0 <= index < PRESET_COUNT:
+            raise ValueError(f"Preset must be 0-{PRESET_COUNT - 1}.")
+        self.ser.write(bytes([PRESET_SELECT_BYTE + index]))
+        if self.pipeline:
+            try:
+                response = self.pipeline.echoes.get(timeout=self.ser.timeout)
+            except queue.Empty:
+                response = b""
+        else:
+            response = self.ser.read(1)
+        while response in (b"F", b"C", bytes([FRAME_SYNC])): # Notification before the answer
+            if response == b"F":
+                self._queue_fired_line("F" + self.ser.readline().decode())
+            elif response == b"C":
+                self._clock_lost(*(int(field) for field in self.ser.readline().decode().split()[1:3]))
+            elif not self._read_notification_frame(self._read_frame(response)):
+                raise RuntimeError("Unexpected frame from Pico")
+            response = self.ser.read(1)
+        if response != bytes([PRESET_SELECT_BYTE + index]):
+            raise RuntimeError(f"Pico rejected preset {index} (not stored, invalid in the current mode "
+                               f"or select pins active, received {response!r})")
+
+    def set_preset_gpio(self, enabled):
+        self._preset_command("g", 1 if enabled else 0)
+
+    # Saves the parameters of all channels, the preset bank (with the select pin setting), the
+    # trigger qualification and the system clock to flash, the pico restores them at power-up.
+    def save_config(self):
+        if self.binary:
+            self._transceive_frame(FRAME_OP_SAVE)
+            return
+        self.ser.write(b"W")
+        response = self._readline()
+        if response != "OK":
+            raise RuntimeError(f"Save failed (not available during a sweep): '{response}'")
+
+    # Schedule mode: every pulse of a train has its own length and spacing (in ns).
+    # The offset is still set with set_parameters(), an empty schedule goes back to uniform trains.
+    def set_schedule(self, pulses):
+        if len(pulses) > SCHEDULE_MAX_PULSES:
+            raise ValueError(f"Schedule exceeds {SCHEDULE_MAX_PULSES} pulses.")
+        payload = b"".join(struct.pack("<HI", self._to_cycles("length", length), self._to_cycles("spacing", spacing))
+                           for length, spacing in pulses)
+        self._transceive_frame(FRAME_OP_SCHEDULE, payload)
+
+    def clear_schedule(self):
+        self.set_schedule([])
+
+    # Burst mode: one trigger fires the configured train (length/spacing/repeats) at several
+    # absolute offsets (in ns, ascending). Trains must be at least train duration + 40 ns apart.
+    def set_burst(self, offsets):
+        if len(offsets) > BURST_MAX_OFFSETS:
+            raise ValueError(f"Burst exceeds {BURST_MAX_OFFSETS} offsets.")
+        payload = b"".join(struct.pack("<I", self._to_cycles("offset", offset)) for offset in offsets)
+        self._transceive_frame(FRAME_OP_BURST, payload)
+
+    def clear_burst(self):
+        self.set_burst([])
+
+    # Stimulus generator on GPIO_5 (test trigger): pulses are (high_ns, low_ns) pairs, the
+    # pattern is played `repeats` times (0 = continuous loop) and replaces the running one.
+    def set_stimulus_pattern(self, pulses, repeats=0):
+        if len(pulses) > STIMULUS_PATTERN_MAX_PULSES:
+            raise ValueError(f"Stimulus pattern exceeds {STIMULUS_PATTERN_MAX_PULSES} pulses.")
+        if len(pulses) * max(repeats, 1) > STIMULUS_MAX_PULSES:
+            raise ValueError(f"Stimulus pattern times repeats exceeds {STIMULUS_MAX_PULSES} pulses.")
+        payload = struct.pack("<I", repeats)
+        for high, low in pulses:
+            high_cycles = self._time_to_cycles(high)
+            low_cycles = self._time_to_cycles(low)
+            if min(high_cycles, low_cycles) < STIMULUS_MIN_CYCLES or max(high_cycles, low_cycles) > STIMULUS_MAX_CYCLES:
+                raise ValueError(f"Stimulus times must be {self._cycles_to_ns(STIMULUS_MIN_CYCLES)}-"
+                                 f"{self._cycles_to_ns(STIMULUS_MAX_CYCLES)} ns.")
+            payload += struct.pack("<II", high_cycles, low_cycles)
+        self._transceive_frame(FRAME_OP_STIMULUS, payload)
+
+    def set_stimulus(self, frequency_hz, duty=0.5, count=0):
+        # Square wave of `count` pulses (0 = continuous), times rounded to the nearest cycle
+        period_ns = 1_000_000_000 / frequency_hz
+        high = round(period_ns * duty)
+        self.set_stimulus_pattern([(high, round(period_ns) - high)], count)
+
+    def stop_stimulus(self):
+        self.set_stimulus_pattern([])
+
+    # Trigger qualification of all channels: only every (skip + 1)th trigger edge fires them, and
+    # with a minimum width only edges that stay high that long count. The filter delays the
+    # trigger by its width (offsets count from there). Skip count and width filter are not
+    # available in burst mode.
+    def set_trigger_qualification(self, skip=0, min_width_ns=0):
+        width = self._time_to_cycles(min_width_ns)
+        if width > QUALIFIER_MAX_WIDTH:
+            raise ValueError(f"Minimum width must be at most {self._cycles_to_ns(QUALIFIER_MAX_WIDTH)} ns.")
+        if self.binary:
+            self._transceive_frame(FRAME_OP_QUALIFIER, struct.pack("<II", skip, width))
+            return
+        self._qualifier_command(f"Q k {skip} q {width} n 0")
+
+    def _qualifier_command(self, command):
+        self.ser.write(command.encode('ascii'))
+        response = self._readline()
+        if response != "OK":
+            raise RuntimeError(f"Setting trigger qualification: '{response}'")
+
+    # Pattern trigger: fire when the last `bits` samples of the trigger input, taken every
+    # sample_period_ns, equal `pattern` (oldest sample in the highest bit). Replaces the edge
+    # trigger until set_trigger_qualification() is called. The trigger follows the sample that
+    # completed the match by one sample period (minus one cycle compared to the edge trigger).
+    def set_pattern_trigger(self, pattern, bits, sample_period_ns):
+        period = self._time_to_cycles(sample_period_ns)
+        if not 1 <= bits <= PATTERN_MAX_BITS or pattern >> bits:
+            raise ValueError(f"Pattern must have 1-{PATTERN_MAX_BITS} bits.")
+        if not PATTERN_MIN_PERIOD <= period <= PATTERN_MAX_PERIOD:
+            raise ValueError(f"Sample period must be {self._cycles_to_ns(PATTERN_MIN_PERIOD)}-"
+                             f"{self._cycles_to_ns(PATTERN_MAX_PERIOD)} ns.")
+        if self.binary:
+            self._transceive_frame(FRAME_OP_QUALIFIER, struct.pack("<IIIII", 0, 0, pattern, bits, period))
+            return
+        self._qualifier_command(f"Q k 0 q 0 x {pattern} n {bits} b {period}")
+
+    # Trigger on a UART byte (8N1, idle high) sent by the target to the trigger input: matches the
+    # stop bit or idle level before the start bit, the start bit and the data bits, sampled
+    # samples_per_bit times per bit (at most 3, the window holds 32 samples). The trigger comes
+    # at the end of the last data bit. The baud rate has to match within about 1 / (10 *
+    # samples_per_bit) of a bit over the frame, a byte is missed if a sample falls onto an edge.
+    def set_uart_trigger(self, byte, baud, samples_per_bit=3):
+        if not 1 <= samples_per_bit <= PATTERN_MAX_BITS // 10:
+            raise ValueError(f"samples_per_bit must be 1-{PATTERN_MAX_BITS // 10}.")
+        pattern = 0
+        for bit in [1, 0] + [(byte >> i) & 1 for i in range(8)]:
+            for _ in range(samples_per_bit):
+                pattern = (pattern << 1) | bit
+        self.set_pattern_trigger(pattern, 10 * samples_per_bit, 1_000_000_000 / (baud * samples_per_bit))
+
+    def get_trigger_qualification(self):
+        return {"skip": self._get_status("k"), "min_width": self._cycles_to_ns(self._get_status("q"))}
+
+    # One-shot mode of channel 0: arm() arms a single shot (the next trigger fires it, later
+    # triggers are ignored until the next arm) and returns its sequence number. The pico reports
+    # the shot as soon as its train is finished, wait_fired() waits for that report.
+    # Additional channels keep firing on every trigger.
+    def arm(self):
+        return self._set_one_shot(1)
+
+    def disarm(self):
+        # Leave one-shot mode, channel 0 fires on every trigger again
+        self._set_one_shot(0)
+
+    def _set_one_shot(self, arm):
+        if self.binary:
+            (seq,) = struct.unpack("<I", self._transceive_frame(FRAME_OP_ARM, bytes([arm])))
+            return seq
+        self.ser.write(f"A {arm}".encode('ascii'))
+        response = self._readline()
+        if not response.startswith("OK "):
+            raise RuntimeError(f"Arming Pico: '{response}'")
+        return int(response.split()[1])
+
+    def wait_fired(self, seq=None, timeout=1.0):
+        # Sequence number of the next shot the pico reports (or of shot `seq`, earlier reports
+        # are dropped), None if none arrived within `timeout` seconds
+        report = self.wait_fired_report(seq, timeout)
+        return None if report is None else report[0]
+
+    def wait_fired_report(self, seq=None, timeout=1.0):
+        # Like wait_fired(), but returns (sequence number, fire timestamp in µs since boot,
+        # trigger edges counted up to the shot)
+        deadline = time.monotonic() + timeout
+        if self.pipeline:
+            with self.pipeline.fired_cond:
+                while True:
+                    while self.fired:
+                        fired = self.fired.popleft()
+                        if seq is None or fired[0] == seq:
+                            return fired
+                    remaining = deadline - time.monotonic()
+                    if remaining <= 0:
+                        return None
+                    self.pipeline.fired_cond.wait(remaining)
+        saved_timeout = self.ser.timeout
+        try:
+            while True:
+                while self.fired:
+                    fired = self.fired.popleft()
+                    if seq is None or fired[0] == seq:
+                        return fired
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    return None
+                self.ser.timeout = remaining
+                if self.binary:
+                    frame = self._read_frame()
+                    if frame is not None and not self._read_notification_frame(frame):
+                        raise RuntimeError(f"Unexpected frame from Pico (opcode {frame[0]:#04x})")
+                else:
+                    line = self._readline()
+                    if line:
+                        raise RuntimeError(f"Unexpected response from Pico: '{line}'")
+        finally:
+            self.ser.timeout = saved_timeout
+
+    # Timing self-test: trigger-to-pulse latency of a channel over `shots` triggers, measured
+    # by the pico itself (see README). Times are in ns, the histogram maps latency -> shots.
+    def run_selftest(self, shots, channel=0):
+        if not 1 <= shots <= SELFTEST_MAX_SHOTS:
+            raise ValueError(f"Shots must be 1-{SELFTEST_MAX_SHOTS}.")
+        # The pico answers once all shots were taken (or after 100 ms without a trigger)
+        data = self._transceive_frame(FRAME_OP_SELFTEST, struct.pack("<BI", channel, shots),
+                                      self.ser.timeout + shots * SELFTEST_SHOT_TIMEOUT_S)
+        fields = struct.unpack(f"<{6 + SELFTEST_HIST_BINS}I", data)
+        taken, misses, min_cycles, max_cycles, mean_milli, hist_base = fields[:6]
+        return {
+            "shots": taken,
+            "misses": misses,
+            "min": self._cycles_to_ns(min_cycles),
+            "max": self._cycles_to_ns(max_cycles),
+            "mean": self._cycles_to_ns(mean_milli / 1000),
+            "histogram": {self._cycles_to_ns(hist_base + i): count
+                          for i, count in enumerate(fields[6:]) if count},
+        }
+
+    def get_latency_stats(self, reset=False):
+        # Time the pico spent on the SETs since boot or the last reset, in ns: "apply" is the
+        # parameter update on core0 (update_delay() or a program swap), "frame" a SET frame from
+        # its last byte to the sent response. Each with count, last, min, max and mean.
+        fields = struct.unpack("<10I", self._transceive_frame(FRAME_OP_LATENCY, bytes([1 if reset else 0])))
+        names = ("count", "last", "min", "max", "mean")
+        return {kind: {name: value if name == "count" else self._cycles_to_ns(value)
+                       for name, value in zip(names, fields[i * 5:i * 5 + 5])}
+                for i, kind in enumerate(("apply", "frame"))}
+
+
+class CampaignLog:
+    # Append-only binary log of one-shot campaigns (see README): shot() arms channel 0, waits for
+    # its FIRED report and appends a CAMPAIGN_RECORD with the host times, the report and the
+    # parameters of the shot in cycles. load_campaign_log() maps the file into numpy.
+    def __init__(self, dc, path):
+        self.dc = dc
+        self.clock_hz = dc.clock_hz or dc.get_clock()
+        self.file = open(path, "ab")
+        if self.file.tell() == 0:
+            self.file.write(CAMPAIGN_HEADER.pack(CAMPAIGN_MAGIC, CAMPAIGN_VERSION, CAMPAIGN_RECORD.size, self.clock_hz))
+        else:
+            header = read_campaign_header(path)
+            if header["clock_hz"] != self.clock_hz:
+                self.file.close()
+                raise RuntimeError(f"Log was recorded at {header['clock_hz']} Hz, the pico runs at {self.clock_hz} Hz")
+            # Drop a record that was cut off, so the new ones stay aligned
+            self.file.truncate(CAMPAIGN_HEADER.size + header["shots"] * CAMPAIGN_RECORD.size)
+            self.file.seek(0, 2)
+        # Parameters of the last shot in cycles, only changes are sent to the pico
+        values = struct.unpack("<4I", dc._transceive_frame(FRAME_OP_GET, b"olsr"))
+        self.params = dict(zip(("offset", "length", "spacing", "repeats"), values))
+        self.pending = []
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_val, exc_tb):
+        self.close()
+
+    def close(self):
+        if not self.file.closed:
+            self.flush()
+            self.file.close()
+
+    def flush(self):
+        self.file.write(b"".join(self.pending))
+        self.file.flush()
+        self.pending = []
+
+    def shot(self, parameters=None, timeout=1.0, point=None):
+        # Sets `parameters` (ns, like set_parameters()) and fires one shot. `point` only logs
+        # the parameters (e.g. the point of a running sweep) without sending them.
+        # Returns the record as a dict, host_fired_ns is 0 if no trigger came within `timeout`.
+        if parameters:
+            changed = {key: value for key, value in parameters.items()
+                       if self.params.get(key) != self.dc._to_cycles(key, value)}
+            if changed:
+                self.dc.set_parameters(changed)
+                self.params.update({key: self.dc._to_cycles(key, value) for key, value in changed.items()})
+        logged = self.params
+        if point is not None:
+            logged = {key: self.dc._to_cycles(key, value) for key, value in point.items()}
+        host_arm_ns = time.time_ns()
+        seq = self.dc.arm()
+        report = self.dc.wait_fired_report(seq, timeout)
+        host_fired_ns = time.time_ns() if report is not None else 0
+        device_us, triggers = report[1:] if report is not None else (0, 0)
+        record = (host_arm_ns, host_fired_ns, seq, device_us, triggers, logged.get("offset", 0),
+                  logged.get("spacing", 0), logged.get("length", 0), logged.get("repeats", 0))
+        self.pending.append(CAMPAIGN_RECORD.pack(*record))
+        if len(self.pending) >= CAMPAIGN_FLUSH_SHOTS:
+            self.flush()
+        return dict(zip((name for name, _ in CAMPAIGN_FIELDS), record))
+
+
+def read_campaign_header(path):
+    # Header of a campaign log and the number of complete records
+    with open(path, "rb") as f:
+        data = f.read(CAMPAIGN_HEADER.size)
+        size = f.seek(0, 2)
+    if len(data) != CAMPAIGN_HEADER.size:
+        raise RuntimeError(f"{path}: not a campaign log (too short)")
+    magic, version, record_size, clock_hz = CAMPAIGN_HEADER.unpack(data)
+    if magic != CAMPAIGN_MAGIC or version != CAMPAIGN_VERSION or record_size != CAMPAIGN_RECORD.size:
+        raise RuntimeError(f"{path}: not a campaign log of version {CAMPAIGN_VERSION}")
+    return {"version": version, "clock_hz": clock_hz, "shots": (size - CAMPAIGN_HEADER.size) // record_size}
+
+
+def load_campaign_log(path):
+    # Records of a campaign log as a read-only numpy structured array (memory-mapped, fields
+    # of CAMPAIGN_FIELDS, parameters in cycles of read_campaign_header()["clock_hz"])
+    import numpy as np
+    header = read_campaign_header(path)
+    dtype = np.dtype(CAMPAIGN_FIELDS)
+    if not header["shots"]:
+        return np.zeros(0, dtype)
+    return np.memmap(path, dtype=dtype, mode="r", offset=CAMPAIGN_HEADER.size, shape=(header["shots"],))
 
-        # Return paramter in ns (multiply by 5)
-        return raw * divider
 
 def main():
     parser = argparse.ArgumentParser(description='Control delay parameters on a Raspberry Pi Pico')
     parser.add_argument('--port', default='/dev/ttyACM0', help='Serial port')
-    parser.add_argument('--get', nargs='*', choices=['offset', 'length', 'spacing', 'repeats'],
+    parser.add_argument('--baudrate', type=int, default=115200,
+                        help='Baud rate of the hardware UART transport (e.g. 3000000, ignored over USB)')
+    parser.add_argument('--binary', action='store_true', help='Use the binary frame protocol')
+    parser.add_argument('--channel', type=int, default=0, help='Output channel (0 = main output)')
+    parser.add_argument('--get', nargs='*', choices=['offset', 'length', 'spacing', 'repeats', 'cooldown', 'multiplier'],
                         help='Get one or more parameters')
     parser.add_argument('--set', nargs='*', metavar='PARAM=VALUE',
                         help='Set one or more parameters (e.g. --set offset=100 length=200)')
+    parser.add_argument('--clock', type=int, metavar='KHZ',
+                        help='Switch the system clock of the pico before setting parameters (e.g. 250000)')
+    parser.add_argument('--ext-clock', type=int, metavar='KHZ',
+                        help='Clock the pico from the target clock at GPIO_20 with this frequency (e.g. 48000)')
+    parser.add_argument('--stimulus', type=float, metavar='HZ',
+                        help='Square wave on the test trigger output (binary frame, also without --binary), 0 = off')
+    parser.add_argument('--duty', type=float, default=0.5, help='Duty cycle of --stimulus (0-1)')
+    parser.add_argument('--count', type=int, default=0, help='Pulses of --stimulus (0 = continuous)')
+    parser.add_argument('--skip', type=int, metavar='N',
+                        help='Fire only on every (N + 1)th trigger edge (resets the edge count)')
+    parser.add_argument('--min-width', type=int, default=0, metavar='NS',
+                        help='Ignore trigger pulses shorter than NS (with --skip, 0 = no filter)')
+    parser.add_argument('--uart-trigger', type=lambda v: int(v, 0), metavar='BYTE',
+                        help='Trigger on a UART byte at the trigger input (e.g. 0xA5, see --baud)')
+    parser.add_argument('--baud', type=int, default=115200, help='Baud rate of --uart-trigger')
+    parser.add_argument('--store-preset', type=int, metavar='N',
+                        help='Store the parameters of channel 0 (after --set) as preset N')
+    parser.add_argument('--preset', type=int, metavar='N', help='Switch channel 0 to preset N')
+    parser.add_argument('--arm', type=float, metavar='SECONDS',
+                        help='Arm a single shot of channel 0 and wait up to SECONDS for it to fire')
+    parser.add_argument('--shots', type=int, default=1, help='Shots to fire one after another with --arm')
+    parser.add_argument('--log', metavar='FILE', help='Append the shots of --arm to a binary campaign log')
+    parser.add_argument('--disarm', action='store_true', help='Leave one-shot mode (fire on every trigger)')
+    parser.add_argument('--save', action='store_true',
+                        help='Save the configuration to flash (after all other actions), restored at power-up')
+    parser.add_argument('--stats', action='store_true', help='Print the trigger counters of the channel')
+    parser.add_argument('--selftest', type=int, metavar='SHOTS',
+                        help='Measure the trigger-to-pulse latency of the channel (binary protocol)')
 
     args = parser.parse_args()
 
-    with DelayController(port=args.port) as dc:
+    with DelayController(port=args.port, baudrate=args.baudrate, binary=args.binary,
+                         low_latency=args.baudrate != 115200) as dc:
+            if args.clock:
+                try:
+                    print(f"Clock = {dc.set_clock(args.clock)} Hz ({dc.get_resolution()} ns per cycle)")
+                except RuntimeError as e:
+                    print(f"Error: {e}")
+
+            if args.ext_clock:
+                try:
+                    print(f"Clock = {dc.set_external_clock(args.ext_clock)} Hz from GPIO_20 "
+                          f"({dc.get_resolution()} ns per cycle)")
+                except RuntimeError as e:
+                    print(f"Error: {e}")
+
             # Set parameters
             if args.set:
                 params = {}
@@ -104,7 +1031,7 @@ def main():
                         print(f"Invalid format or value: '{item}' (expected PARAM=VALUE)")
                 if params:
                     try:
-                        dc.set_parameters(params)
+                        dc.set_parameters(params, args.channel)
                         for k, v in params.items():
                             print(f"Set {k} = {v}")
                     except RuntimeError as e:
@@ -112,13 +1039,104 @@ def main():
 
             # Get parameters
             if args.get:
-                for key in args.get:
-                    val = dc.get_parameter(key)
-                    if val is not None:
+                try:
+                    for key, val in dc.get_parameters(args.get, args.channel).items():
                         print(f"{key} = {val}")
+                except RuntimeError as e:
+                    print(f"Error: {e}")
+
+            if args.stimulus is not None:
+                try:
+                    if args.stimulus:
+                        dc.set_stimulus(args.stimulus, args.duty, args.count)
+                        print(f"Stimulus = {args.stimulus} Hz, duty {args.duty}, {args.count or 'continuous'} pulses")
+                    else:
+                        dc.stop_stimulus()
+                        print("Stimulus off")
+                except (RuntimeError, ValueError) as e:
+                    print(f"Error: {e}")
+
+            if args.skip is not None:
+                try:
+                    dc.set_trigger_qualification(args.skip, args.min_width)
+                    print(f"Trigger = every {args.skip + 1}. edge, min width {args.min_width} ns")
+                except (RuntimeError, ValueError) as e:
+                    print(f"Error: {e}")
+
+            if args.uart_trigger is not None:
+                try:
+                    dc.set_uart_trigger(args.uart_trigger, args.baud)
+                    print(f"Trigger = UART byte 0x{args.uart_trigger:02X} at {args.baud} baud")
+                except (RuntimeError, ValueError) as e:
+                    print(f"Error: {e}")
+
+            if args.store_preset is not None:
+                try:
+                    dc.store_preset(args.store_preset)
+                    print(f"Stored preset {args.store_preset}")
+                except (RuntimeError, ValueError) as e:
+                    print(f"Error: {e}")
+
+            if args.preset is not None:
+                try:
+                    dc.select_preset(args.preset)
+                    print(f"Preset = {args.preset}")
+                except (RuntimeError, ValueError) as e:
+                    print(f"Error: {e}")
+
+            if args.arm is not None and args.log:
+                try:
+                    with CampaignLog(dc, args.log) as log:
+                        fired = sum(bool(log.shot(timeout=args.arm)["host_fired_ns"]) for _ in range(args.shots))
+                    print(f"Logged {args.shots} shots to {args.log}, {fired} fired")
+                except RuntimeError as e:
+                    print(f"Error: {e}")
+            elif args.arm is not None:
+                try:
+                    for _ in range(args.shots):
+                        seq = dc.arm()
+                        print(f"Armed shot {seq}")
+                        report = dc.wait_fired_report(seq, args.arm)
+                        if report is None:
+                            print(f"Shot {seq} did not fire within {args.arm} s")
+                        else:
+                            print(f"Fired shot {seq} at {report[1]} us, trigger {report[2]}")
+                except RuntimeError as e:
+                    print(f"Error: {e}")
+
+            if args.disarm:
+                try:
+                    dc.disarm()
+                    print("One-shot mode off")
+                except RuntimeError as e:
+                    print(f"Error: {e}")
+
+            if args.stats:
+                for key, val in dc.get_stats(args.channel).items():
+                    print(f"{key} = {val}")
+
+            if args.selftest:
+                try:
+                    result = dc.run_selftest(args.selftest, args.channel)
+                    print(f"shots = {result['shots']}, misses = {result['misses']}")
+                    print(f"latency min/max/mean = {result['min']}/{result['max']}/{result['mean']} ns")
+                    for latency, count in result["histogram"].items():
+                        print(f"  {latency} ns: {count}")
+                except RuntimeError as e:
+                    print(f"Error: {e}")
+
+            if args.save:
+                try:
+                    dc.save_config()
+                    print("Configuration saved")
+                except RuntimeError as e:
+                    print(f"Error: {e}")
 
-            if not args.get and not args.set:
-                print("No action specified. Use --get or --set.")
+            if not args.get and not args.set and not args.clock and not args.ext_clock and args.stimulus is None and not args.stats \
+                    and not args.selftest and args.arm is None and not args.disarm and args.store_preset is None \
+                    and args.preset is None and not args.save and args.uart_trigger is None:
+                print("No action specified. Use --get, --set, --clock, --stimulus, --preset, --arm, --save, --stats "
+                      "or --selftest.")
 
 
 if __name__ == '__main__':
@@ -2,271 +2,3752 @@
 #include "stdlib.h"
 #include "ctype.h"
 #include "string.h"
+#include "stddef.h"
 #include "pico/stdlib.h"
+#include "pico/multicore.h"
 #include "hardware/pio.h"
 #include "hardware/dma.h"
 #include "hardware/clocks.h"
+#include "hardware/vreg.h"
+#include "hardware/irq.h"
+#include "hardware/flash.h"
+#include "hardware/uart.h"
+#include "hardware/structs/systick.h"
+#include "pico/stdio/driver.h"
 #include "pulsegen.pio.h"
+#include "pulsegen_schedule.pio.h"
+#include "pulsegen_burst.pio.h"
+#include "pulsegen_single.pio.h"
+#include "pulsegen_train.pio.h"
+#include "trigger_qualifier.pio.h"
+#include "trigger_qualifier_skip.pio.h"
+#include "trigger_qualifier_width.pio.h"
+#include "trigger_pattern.pio.h"
 #include "trigger_test.pio.h"
+#include "selftest_capture.pio.h"
 
 
 #define TRIGGER_PIN 0
 #define PULSE_PIN 1
 #define TEST_PIN 5
 
-#define ENABLE_TEST_PIN_PIO
-// #define ENABLE_TEST_PIN_LOOP // makes serial configuration unresponsive
-#define TEST_PIN_HIGH_CYCLES 10
-#define TEST_PIN_LOW_CYCLES 10
+// Pulse outputs sharing TRIGGER_PIN. Channel 0 runs on pio0 (with sweep, schedule and burst
+// mode), the other channels use the free SMs of pio1 first, then the remaining SMs of pio0.
+#define NUM_CHANNELS 3
+#define CHANNEL_PINS { PULSE_PIN, 2, 3, 4, 6, 7, 8 } // Output pin per channel (TEST_PIN skipped)
 
-int dma_chan; // dma channel (set inside setup_dma and needed in dma_irq_handler())
+#define ENABLE_TEST_PIN_PIO // Stimulus generator on TEST_PIN (see stimulus_start())
+#define TEST_PIN_HIGH_CYCLES 2000 // Boot setting of the stimulus generator: 10 µs high, 10 µs low at 200 MHz
+#define TEST_PIN_LOW_CYCLES 2000
+
+// The trigger is watched by one trigger_qualifier SM per PIO block, which raises PIO IRQ 0 for
+// all pulsegen SMs of that block (IRQ flags are not shared between blocks)
+#define QUALIFIER_SM 3 // SM of the trigger qualifier on pio0 and pio1
+#define QUALIFIER_LATENCY 2 // Cycles the qualifier adds between the trigger edge and `wait_trigger`
+#define QUALIFIER_MIN_WIDTH 2 // Smallest width filter of trigger_qualifier_width.pio (below: no filter)
+#define QUALIFIER_MAX_WIDTH 33 // 5 bit delay of its `edge` instruction plus 2
+#define PATTERN_MAX_BITS 32 // Samples compared by trigger_pattern.pio (its ISR window)
+#define PATTERN_LOOP_CYCLES 4 // SM cycles per sample of trigger_pattern.pio
+#define PATTERN_MIN_PERIOD PATTERN_LOOP_CYCLES // Sample period in cycles (clock divider 1)
+#define PATTERN_MAX_PERIOD (PATTERN_LOOP_CYCLES * 65535u) // Largest integer clock divider
+
+#if defined(ENABLE_TEST_PIN_PIO)
+#define TEST_SM 2 // SM of the test trigger on pio1
+#define PIO1_CHANNELS 2 // Pulse channels next to the test trigger (pulsegen + trigger_test + trigger_qualifier fill pio1)
+#define STIMULUS_DMA_CHANNELS 2
+#else
+#define PIO1_CHANNELS 3
+#define STIMULUS_DMA_CHANNELS 0
+#endif
+#define PIO0_SHARED (NUM_CHANNELS > 1 + PIO1_CHANNELS) // Channel 0 shares pio0 (no program swaps)
+#if NUM_CHANNELS > 1 + PIO1_CHANNELS + 2
+#error "NUM_CHANNELS exceeds the free state machines"
+#endif
+#if 4 + 2 * (NUM_CHANNELS - 1) + STIMULUS_DMA_CHANNELS > 12
+#error "NUM_CHANNELS exceeds the DMA channels (4 for channel 0, 2 per additional channel, 2 for the stimulus generator)"
+#endif
+
+// Bit fields of the combined word of pulsegen.pio: repeats from bit 0 up, then length and
+// spacing (see pack_combined_parameters()). Set in CMakeLists.txt, which also patches the
+// `out` widths of the PIO programs.
+#ifndef PULSEGEN_REPEATS_BITS
+#define PULSEGEN_REPEATS_BITS 5
+#endif
+#ifndef PULSEGEN_LENGTH_BITS
+#define PULSEGEN_LENGTH_BITS 7
+#endif
+#ifndef PULSEGEN_SPACING_BITS
+#define PULSEGEN_SPACING_BITS 20
+#endif
+#if PULSEGEN_REPEATS_BITS < 1 || PULSEGEN_LENGTH_BITS < 1 || PULSEGEN_SPACING_BITS < 1 || \
+    PULSEGEN_REPEATS_BITS + PULSEGEN_LENGTH_BITS + PULSEGEN_SPACING_BITS > 32
+#error "PULSEGEN_*_BITS: every field needs at least 1 bit, together at most 32"
+#endif
+#define LENGTH_SHIFT PULSEGEN_REPEATS_BITS
+#define SPACING_SHIFT (PULSEGEN_REPEATS_BITS + PULSEGEN_LENGTH_BITS)
+#define REPEATS_FIELD_MAX ((1u << PULSEGEN_REPEATS_BITS) - 1) // Largest repeat count
+#define LENGTH_FIELD_MAX ((1u << PULSEGEN_LENGTH_BITS) - 1) // Largest length loop count
+#define SPACING_FIELD_MAX ((1u << PULSEGEN_SPACING_BITS) - 1) // Largest spacing loop count
+
+// Minimum parameter values (in cycles) given by the instructions in pulsegen.pio
+#define MIN_OFFSET (2 + QUALIFIER_LATENCY) // Offsets stay relative to the trigger edge
+#define MIN_LENGTH 1
+#define MIN_SPACING 6
+#define SINGLE_MIN_OFFSET QUALIFIER_LATENCY // pulsegen_single.pio: the pulse follows the offset loop directly
+#define TRAIN_MIN_SPACING 4 // pulsegen_train.pio: spacing and length are reloaded with a single mov each
+#define MAX_PRESCALER 16 // Spacing loop multiplier, patched into the 4 bit delay of `spacing_loop`
+#define BURST_MIN_GAP 8 // Minimum gap between two burst trains on top of the train duration
+#define DEFAULT_COOLDOWN 256 // Cooldown loop count after every train (see `request` in pulsegen.pio)
+
+// Binary frame protocol (fast path next to the ASCII commands, see handle_frame())
+#define FRAME_SYNC 0xA5 // First byte of a binary frame (never a valid ASCII command)
+#define FRAME_SYNC_TAGGED 0xA6 // First byte of a tagged frame, followed by a tag byte the response repeats
+#define FRAME_MAX_LEN 250 // Maximum value of the LEN byte (opcode + payload)
+#define FRAME_TIMEOUT_US 20000 // Deadline for the rest of a frame after FRAME_SYNC was received
+#define SWEEP_POINT_LEN 12 // Bytes per point in FRAME_OP_SWEEP_LOAD: offset u32, spacing u32, length u16, repeats u16
+
+// System clock, selectable at runtime (see set_system_clock()). The state machines run at the
+// full system clock, so all parameters are counted in its cycles (5 ns at the boot clock of 200 MHz).
+#define SYS_CLOCK_MIN_KHZ 48000
+#define SYS_CLOCK_MAX_KHZ 300000
+#define SYS_CLOCK_VREG_KHZ 250000 // Above this the core voltage is raised to 1.20 V
+#define SYS_CLOCK_VREG_SETTLE_US 1000 // Wait after raising the core voltage
+#define EXT_CLOCK_PIN 20 // GPIN0, target clock input of the external clock mode (see set_external_clock())
+#define EXT_CLOCK_MAX_KHZ 50000 // Highest GPIN input frequency
+#define EXT_CLOCK_PERI_KHZ 48000 // clk_peri runs from pll_usb meanwhile (UART baud rate)
+
+// Stimulus generator on TEST_PIN (see trigger_test.pio), pulses are [high, low] times in cycles
+#define STIMULUS_MIN_CYCLES 3 // Shortest high or low time (loop count + 3)
+#define STIMULUS_MAX_CYCLES (0x7FFFFFFFu + STIMULUS_MIN_CYCLES) // 31 bit loop count of a phase word
+#define STIMULUS_PATTERN_MAX_PULSES 30 // Pulses of a pattern loaded by the host (one frame)
+#define STIMULUS_MAX_PULSES 1024 // Pulses of the pattern times its repeats (DMA buffer, 8 bytes per pulse)
+#define STIMULUS_PULSE_LEN 8 // Bytes per pulse in FRAME_OP_STIMULUS: high u32, low u32
+
+// Timing self-test (see selftest_run()): a capture SM next to channel 0 samples a channel output
+#define SELFTEST_SM 1 // Free SM of pio0 (not available with PIO0_SHARED)
+#define SELFTEST_WINDOW_WORDS 256 // Capture window per shot in RX words of 32 samples (8192 cycles)
+#define SELFTEST_CAPTURE_LATENCY 1 // Cycles between the trigger edge and sample 0 (see selftest_capture.pio)
+#define SELFTEST_HIST_BINS 16 // Latency histogram bins of one cycle each
+#define SELFTEST_MAX_SHOTS 100000
+#define SELFTEST_SHOT_TIMEOUT_US 100000 // The test ends if no trigger arrives within this time
+
+// Core split: core0 owns PIO and DMA, core1 runs USB stdio and the command parser (see control_call())
+#define COMMAND_CORE_STACK_SIZE 8192 // Bytes, handle_frame() and printf() need more than the default 2KB
+#define ASCII_MAX_ASSIGNMENTS 8 // `key value` pairs per ASCII command
+
+// #define ENABLE_COMMAND_UART // Commands over a hardware UART instead of USB CDC (see command_uart_init())
+#if defined(ENABLE_COMMAND_UART)
+#define COMMAND_UART uart0
+#define COMMAND_UART_IRQ UART0_IRQ
+#define COMMAND_UART_TX_PIN 12
+#define COMMAND_UART_RX_PIN 13
+#define COMMAND_UART_BAUD 3000000 // Up to clk_peri / 16 (clk_peri runs at the system clock)
+#define COMMAND_UART_RING_SIZE 1024 // RX ring buffer in bytes (power of 2), holds the largest frames several times
+#endif
+
+// Slowest target clock the command transport keeps working with (clk_sys is the bus clock of
+// both): USB needs clk_sys >= clk_usb (48 MHz), the UART (PL011) a clk_peri of at most 5/3 times
+// clk_sys (clk_peri stays at EXT_CLOCK_PERI_KHZ for the baud rate, see set_external_clock())
+#if defined(ENABLE_COMMAND_UART)
+#define EXT_CLOCK_MIN_KHZ ((EXT_CLOCK_PERI_KHZ * 3 + 4) / 5)
+#else
+#define EXT_CLOCK_MIN_KHZ 48000
+#endif
+
+#define SWEEP_MAX_POINTS 8192 // Capacity of the sweep table (8 bytes per point)
+#define SCHEDULE_PULSE_LEN 6 // Bytes per pulse in FRAME_OP_SCHEDULE: length u16, spacing u32
+
+// Preset bank of channel 0 (see preset_select())
+#define PRESET_SELECT_PIN 9 // First select input, the select pins give the preset number (LSB first)
+#define PRESET_SELECT_PINS 3 // Select inputs GPIO 9-11
+#define PRESET_COUNT (1u << PRESET_SELECT_PINS)
+#define PRESET_SELECT_BYTE 0x80 // Single-byte switch: 0x80 + preset (never a valid ASCII command)
+#define PRESET_NAK 0x15 // Answer to a rejected single-byte switch (accepted ones are echoed)
+
+// Saved configuration (see config_save()): a ring of records in the last sectors of the flash
+#define CONFIG_FLASH_SECTORS 4 // Sectors of the ring, one is erased every CONFIG_SLOTS_PER_SECTOR saves
+#define CONFIG_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - CONFIG_FLASH_SECTORS * FLASH_SECTOR_SIZE)
+#define CONFIG_SLOT_SIZE (2 * FLASH_PAGE_SIZE) // Bytes per record slot
+#define CONFIG_SLOTS_PER_SECTOR (FLASH_SECTOR_SIZE / CONFIG_SLOT_SIZE)
+#define CONFIG_SLOTS (CONFIG_FLASH_SECTORS * CONFIG_SLOTS_PER_SECTOR)
+#define CONFIG_MAGIC 0x43475050 // "PPGC" (erased flash reads 0xFFFFFFFF)
+
+// DMA parameter feed (see param_feed_t)
+#define SCHEDULE_MAX_PULSES 30 // Pulses per train in schedule mode (see pulsegen_schedule.pio)
+#define BURST_MAX_OFFSETS 30 // Trains per trigger in burst mode (see pulsegen_burst.pio)
+#define FEED_UNIFORM_WORDS 3 // Words per uniform parameter set: [cooldown, offset, combined]
+#define FEED_SINGLE_WORDS 3 // [cooldown, offset, length] (see pulsegen_single.pio)
+#define FEED_TRAIN_WORDS 4 // [cooldown, offset, spacing, repeats/length] (see pulsegen_train.pio)
+#define FEED_MAX_WORDS (SCHEDULE_MAX_PULSES + 3) // Longest parameter set: [cooldown, offset, pulses..., terminator]
+#define FEED_RING_SIZE_BITS 15 // log2 of the DMA ring size in bytes (32KB, largest ring the DMA supports)
+#define FEED_RING_WORDS ((1u << FEED_RING_SIZE_BITS) / sizeof(uint32_t))
+#define FEED_RING_SETS (FEED_RING_WORDS / FEED_UNIFORM_WORDS) // Sets wrap around the ring end
+
+typedef enum {
+    FRAME_OP_GET = 0x01,
+    FRAME_OP_SET = 0x02,
+    FRAME_OP_GET_CHANNEL = 0x03,
+    FRAME_OP_SET_CHANNEL = 0x04,
+    FRAME_OP_SWEEP_LOAD = 0x10,
+    FRAME_OP_SWEEP_GRID = 0x11,
+    FRAME_OP_SWEEP_START = 0x12,
+    FRAME_OP_SWEEP_STOP = 0x13,
+    FRAME_OP_SWEEP_RANDOM = 0x14,
+    FRAME_OP_PRESET = 0x15,
+    FRAME_OP_SCHEDULE = 0x20,
+    FRAME_OP_BURST = 0x21,
+    FRAME_OP_CLOCK = 0x30,
+    FRAME_OP_CLOCK_EXT = 0x31,
+    FRAME_OP_CLOCK_LOST = 0x32, // Unsolicited notification of the device (see clock_report())
+    FRAME_OP_SELFTEST = 0x40,
+    FRAME_OP_STIMULUS = 0x50,
+    FRAME_OP_QUALIFIER = 0x60,
+    FRAME_OP_ARM = 0x70,
+    FRAME_OP_FIRED = 0x71, // Unsolicited notification of the device (see oneshot_report())
+    FRAME_OP_SAVE = 0x80,
+    FRAME_OP_LATENCY = 0x90
+} FrameOpcode;
+
+typedef enum {
+    FRAME_STATUS_OK = 0x00,
+    FRAME_STATUS_CRC = 0x01,     // CRC mismatch
+    FRAME_STATUS_LENGTH = 0x02,  // Invalid LEN byte or payload length
+    FRAME_STATUS_OPCODE = 0x03,  // Unknown opcode
+    FRAME_STATUS_PARAM = 0x04,   // Unknown parameter key (returned as data byte)
+    FRAME_STATUS_RANGE = 0x05,   // Parameter below its minimum or above its maximum (key returned as data byte)
+    FRAME_STATUS_TIMEOUT = 0x06, // Frame incomplete after FRAME_TIMEOUT_US
+    FRAME_STATUS_SWEEP = 0x07,   // Sweep points exceed SWEEP_MAX_POINTS
+    FRAME_STATUS_MODE = 0x08,    // Not available in schedule or burst mode, during a sweep, with a skip count, in one-shot mode, with preset select pins, saving during a sweep (or with NUM_CHANNELS)
+    FRAME_STATUS_CHANNEL = 0x09, // Channel >= NUM_CHANNELS
+    FRAME_STATUS_FLASH = 0x0A    // Flash write failed (the record read back differs)
+} FrameStatus;
+
+uint32_t sweep_table[SWEEP_MAX_POINTS][2]; // [offset, combined] pairs loaded by the host
+uint32_t sweep_len = 0; // Points walked by the running sweep (1 for a random sweep), 0 if no sweep is running
+uint32_t sweep_source = 0; // Next sweep_table index copied into feed_ring
+uint32_t sweep_written = 0; // Points copied into feed_ring since the sweep was started
+uint32_t sweep_consumed = 0; // Points handed to the state machine since the sweep was started
+uint32_t sweep_ring_index = 0; // feed_ring word index of the next delivery, as of the last sweep_update_consumed()
+uint32_t sweep_ring_partial = 0; // Words of a point the DMA delivered only partially so far
+uint32_t sweep_cooldown = 0; // Cooldown word written with every point (cooldown of the channel at sweep_start())
+uint32_t sweep_underruns = 0; // Refills that came too late (stale points were delivered)
+
+/**
+ * @brief Offset window of a random sweep, every point gets an offset drawn by random_offset().
+ */
+typedef struct {
+    uint32_t seed;
+    uint32_t offset_min;   // Smallest offset in cycles
+    uint32_t offset_count; // Offsets in the window (max - min + 1), 0 if the sweep walks sweep_table
+    uint32_t combined;     // Combined word (length, spacing, repeats) of all points
+} random_params_t;
+
+random_params_t random_params; // Window of the next random sweep, written by core1 (see control_call())
+random_params_t sweep_random; // Window of the running sweep, owned by core0
+
+// Counters since boot, incremented by stats_irq_handler() and stats_dma_irq_handler() on core0
+volatile uint32_t stats_triggers = 0; // Qualified trigger edges of the qualifier of pio0
+volatile uint32_t stats_served[NUM_CHANNELS]; // Triggers served per channel (parameter requests minus program starts)
+int stats_req_chan = -1; // req_chan of the channel 0 feed, one transfer per request
+
+volatile bool oneshot_armed = false; // Channel 0 runs one armed shot (see oneshot_arm()), cleared by stats_dma_irq_handler() once it fired
+uint32_t oneshot_seq = 0; // Sequence number of the last arm, written by core0
+volatile uint32_t oneshot_fired_seq = 0; // Sequence number of the last shot that fired, reported to the host by core1
+uint32_t oneshot_fired_us = 0; // time_us_32() when that shot fired (end of its train)
+uint32_t oneshot_fired_triggers = 0; // stats_triggers when that shot fired
+
+uint32_t schedule_pulses[SCHEDULE_MAX_PULSES]; // Pulse words of the schedule (see pulsegen_schedule.pio)
+uint32_t schedule_len = 0; // Pulses per train in schedule mode, 0 for uniform trains
+uint32_t burst_offsets[BURST_MAX_OFFSETS]; // Absolute train offsets in burst mode (cycles, ascending)
+uint32_t burst_len = 0; // Trains per trigger in burst mode, 0 for a single train
+
+// DMA ring walked during a sweep, refilled from sweep_table by sweep_task(). Sets are 3 words,
+// so they are laid out word by word and wrap around the end of the ring.
+uint32_t feed_ring[FEED_RING_WORDS] __attribute__((aligned(1u << FEED_RING_SIZE_BITS)));
+
+/**
+ * @brief DMA descriptor of a parameter set, written to the data channel by `desc_chan`.
+ *
+ * Field order matches the alias 2 registers TRANS_COUNT, READ_ADDR, WRITE_ADDR_TRIG.
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t read_addr;
+    uint32_t write_addr;
+} param_feed_desc_t;
+
+/**
+ * @brief Chained DMA channels feeding parameter sets to a pulsegen state machine.
+ *
+ * Every parameter request of the state machine (a `push` into its RX FIFO) is answered by
+ * copying one parameter set into its TX FIFO, without any CPU involvement:
+ *
+ * - `req_chan` is paced by the RX FIFO, consumes the request word and chains to `ctrl_chan`.
+ * - `ctrl_chan` restarts `data_chan`: in slot mode it points `desc_chan` at the descriptor
+ *   of the active slot, in ring mode it rewrites the transfer count trigger of `data_chan`,
+ *   so it continues with the next set of a DMA ring (the transfer count is reloaded on every
+ *   trigger).
+ * - `desc_chan` (slot mode) writes count, read address and write address of `data_chan`,
+ *   which makes sets of different length switchable with a single pointer write.
+ * - `data_chan` copies the set into the TX FIFO and chains back to `req_chan`.
+ */
+typedef struct {
+    PIO pio;
+    uint sm;
+    uint words;                         // Words per parameter set in ring mode
+    int req_chan;                       // RX FIFO -> request_sink, paced by the parameter requests
+    int ctrl_chan;                      // Restarts data_chan (via desc_chan or transfer count)
+    int desc_chan;                      // Descriptor -> data_chan registers (slot mode)
+    int data_chan;                      // Parameter set -> TX FIFO
+    uint32_t request_sink;              // Discarded request words
+    const param_feed_desc_t *volatile desc_ptr; // Descriptor of the set delivered on the next request (slot mode)
+    uint32_t ring_count;                // Transfer count written by ctrl_chan (ring mode)
+    const uint32_t *ring;               // Base of the active DMA ring (NULL in slot mode)
+    uint ring_size_bits;                // log2 of the ring size in bytes
+    uint32_t slots[2][FEED_MAX_WORDS];  // Double buffer written by param_feed_commit()
+    param_feed_desc_t descs[2];         // Descriptors of the slots
+    uint active_slot;
+    bool one_shot;                      // Requests are consumed but not answered (see oneshot_arm())
+} param_feed_t;
+
+/**
+ * @brief Sets the chain target of a DMA channel, leaving the rest of its configuration untouched.
+ */
+void param_feed_set_chain(uint chan, uint chain_to) {
+    dma_channel_config cfg = dma_get_channel_config(chan);
+    channel_config_set_chain_to(&cfg, chain_to);
+    dma_channel_set_config(chan, &cfg, false);
+}
+
+/**
+ * @brief Configures ctrl_chan, desc_chan and data_chan for slot mode or ring mode.
+ *
+ * Must only be called while the feed is paused and data_chan is idle.
+ */
+void param_feed_configure(param_feed_t *feed) {
+    dma_channel_config data_cfg = dma_channel_get_default_config(feed->data_chan);
+    channel_config_set_transfer_data_size(&data_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&data_cfg, true); // Walk the words of a set
+    channel_config_set_write_increment(&data_cfg, false); // Always write to same PIO FIFO addr
+    channel_config_set_dreq(&data_cfg, pio_get_dreq(feed->pio, feed->sm, true)); // Throttle by PIO TX FIFO
+    channel_config_set_chain_to(&data_cfg, feed->req_chan); // Wait for the next request
+    if (feed->ring) {
+        channel_config_set_ring(&data_cfg, false, feed->ring_size_bits); // Wrap read address at ring end
+    }
+    dma_channel_configure(feed->data_chan, &data_cfg, &feed->pio->txf[feed->sm],
+                          feed->ring ? feed->ring : feed->slots[feed->active_slot], feed->words, false);
+
+    dma_channel_config ctrl_cfg = dma_channel_get_default_config(feed->ctrl_chan);
+    channel_config_set_transfer_data_size(&ctrl_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl_cfg, false);
+    channel_config_set_write_increment(&ctrl_cfg, false);
+    if (feed->ring) {
+        // Restart data_chan where it stopped (next set of the ring)
+        dma_channel_configure(feed->ctrl_chan, &ctrl_cfg, &dma_hw->ch[feed->data_chan].al1_transfer_count_trig,
+                              &feed->ring_count, 1, false);
+    } else {
+        // Hand the active descriptor to desc_chan
+        dma_channel_configure(feed->ctrl_chan, &ctrl_cfg, &dma_hw->ch[feed->desc_chan].al3_read_addr_trig,
+                              &feed->desc_ptr, 1, false);
+    }
+
+    dma_channel_config desc_cfg = dma_channel_get_default_config(feed->desc_chan);
+    channel_config_set_transfer_data_size(&desc_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&desc_cfg, true);
+    channel_config_set_write_increment(&desc_cfg, true); // TRANS_COUNT, READ_ADDR, WRITE_ADDR_TRIG
+    dma_channel_configure(feed->desc_chan, &desc_cfg, &dma_hw->ch[feed->data_chan].al2_transfer_count,
+                          feed->desc_ptr, sizeof(param_feed_desc_t) / sizeof(uint32_t), false);
+}
+
+/**
+ * @brief Stops answering parameter requests, pending requests stay in the RX FIFO.
+ *
+ * Returns once no new transfer of data_chan can be started. data_chan itself may still be
+ * busy delivering a set (see param_feed_flush()).
+ */
+void param_feed_pause(param_feed_t *feed) {
+    // An aborted channel can still trigger its chain (RP2040-E13), so unchain req_chan first
+    param_feed_set_chain(feed->req_chan, feed->req_chan);
+    // The abort can also raise the completion IRQ (counted as request by stats_dma_irq_handler()),
+    // unless a real request is pending already
+    bool irq_enabled = dma_hw->inte0 & (1u << feed->req_chan);
+    bool request_pending = dma_channel_get_irq0_status(feed->req_chan);
+    dma_channel_set_irq0_enabled(feed->req_chan, false);
+    dma_channel_abort(feed->req_chan);
+    if (!request_pending) {
+        dma_channel_acknowledge_irq0(feed->req_chan);
+    }
+    dma_channel_set_irq0_enabled(feed->req_chan, irq_enabled);
+    while (dma_channel_is_busy(feed->ctrl_chan) || dma_channel_is_busy(feed->desc_chan)) {
+        tight_loop_contents();
+    }
+}
+
+/**
+ * @brief Drops the rest of a partially delivered set (feed has to be paused).
+ *
+ * Only needed for sets longer than the TX FIFO, shorter ones are complete once the state
+ * machine left recover_parameters.
+ */
+void param_feed_flush(param_feed_t *feed) {
+    param_feed_set_chain(feed->data_chan, feed->data_chan);
+    dma_channel_abort(feed->data_chan);
+    param_feed_set_chain(feed->data_chan, feed->req_chan);
+}
+
+/**
+ * @brief Starts answering parameter requests (again).
+ *
+ * In one-shot mode req_chan consumes the next request without chaining to ctrl_chan, the state
+ * machine then waits at the `pull` of `request` until a set is delivered with
+ * param_feed_deliver_now().
+ */
+void param_feed_resume(param_feed_t *feed) {
+    dma_channel_config req_cfg = dma_channel_get_default_config(feed->req_chan);
+    channel_config_set_transfer_data_size(&req_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&req_cfg, false);
+    channel_config_set_write_increment(&req_cfg, false);
+    channel_config_set_dreq(&req_cfg, pio_get_dreq(feed->pio, feed->sm, false)); // Paced by requests (RX FIFO)
+    channel_config_set_chain_to(&req_cfg, feed->one_shot ? feed->req_chan : feed->ctrl_chan);
+    dma_channel_configure(feed->req_chan, &req_cfg, &feed->request_sink, &feed->pio->rxf[feed->sm], 1, true);
+}
+
+/**
+ * @brief Claims four DMA channels and starts feeding parameter sets to a state machine.
+ *
+ * The feed starts in slot mode. param_feed_commit() has to be called before the state
+ * machine requests its first set.
+ *
+ * @param feed        Feed to initialize.
+ * @param pio         The PIO instance (e.g., pio0 or pio1).
+ * @param sm          The state machine index (0–3) to send data to.
+ * @param words       Words per parameter set in ring mode.
+ */
+void param_feed_init(param_feed_t *feed, PIO pio, uint sm, uint words) {
+    memset(feed, 0, sizeof(*feed));
+    feed->pio = pio;
+    feed->sm = sm;
+    feed->words = words;
+    feed->ring_count = words;
+    feed->desc_ptr = &feed->descs[0];
+    feed->req_chan = dma_claim_unused_channel(true);
+    feed->ctrl_chan = dma_claim_unused_channel(true);
+    feed->desc_chan = dma_claim_unused_channel(true);
+    feed->data_chan = dma_claim_unused_channel(true);
+
+    param_feed_configure(feed);
+    param_feed_resume(feed);
+}
+
+/**
+ * @brief Stages a new parameter set for slot mode.
+ *
+ * The set is written to the inactive slot, which then becomes active with a single pointer
+ * write. So a request is always answered with a complete (old or new) set.
+ *
+ * @param set         Parameter set.
+ * @param words       Length of the set (max FEED_MAX_WORDS).
+ */
+void param_feed_commit(param_feed_t *feed, const uint32_t *set, uint words) {
+    uint next_slot = feed->active_slot ^ 1;
+    uint32_t next_start = (uint32_t)(uintptr_t)feed->slots[next_slot];
+
+    // The inactive slot may still be delivered if the previous commit happened mid-request
+    while (dma_channel_is_busy(feed->ctrl_chan) || dma_channel_is_busy(feed->desc_chan)) {
+        tight_loop_contents();
+    }
+    while (dma_channel_is_busy(feed->data_chan) &&
+           dma_hw->ch[feed->data_chan].read_addr - next_start < sizeof(feed->slots[0])) {
+        tight_loop_contents();
+    }
+
+    memcpy(feed->slots[next_slot], set, words * sizeof(uint32_t));
+    feed->descs[next_slot] = (param_feed_desc_t){
+        .count = words,
+        .read_addr = next_start,
+        .write_addr = (uint32_t)(uintptr_t)&feed->pio->txf[feed->sm]
+    };
+    feed->desc_ptr = &feed->descs[next_slot]; // Commit (picked up by the next request)
+    feed->active_slot = next_slot;
+}
+
+/**
+ * @brief Waits until data_chan delivered its set (paused feed, sets that fit into the TX FIFO).
+ */
+void param_feed_wait_data(param_feed_t *feed) {
+    while (dma_channel_is_busy(feed->data_chan)) {
+        tight_loop_contents();
+    }
+}
+
+/**
+ * @brief Switches the feed to walk a DMA ring of parameter sets, one set per request.
+ *
+ * @param ring        Ring of sets of `words` words (see param_feed_init()), aligned to its size.
+ *                    Sets may wrap around the end of the ring.
+ * @param size_bits   log2 of the ring size in bytes (max 15).
+ */
+void param_feed_use_ring(param_feed_t *feed, const uint32_t *ring, uint size_bits) {
+    param_feed_pause(feed);
+    param_feed_wait_data(feed);
+    feed->ring = ring;
+    feed->ring_size_bits = size_bits;
+    param_feed_configure(feed);
+    param_feed_resume(feed);
+}
+
+/**
+ * @brief Switches the feed back to the double-buffered parameter slots.
+ */
+void param_feed_use_slots(param_feed_t *feed) {
+    param_feed_pause(feed);
+    param_feed_wait_data(feed);
+    feed->ring = NULL;
+    param_feed_configure(feed);
+    param_feed_resume(feed);
+}
+
+/**
+ * @brief Returns the ring word index data_chan reads next (ring mode).
+ */
+uint32_t param_feed_ring_index(const param_feed_t *feed) {
+    uint32_t read_offset = dma_hw->ch[feed->data_chan].read_addr - (uint32_t)(uintptr_t)feed->ring;
+    return (read_offset & ((1u << feed->ring_size_bits) - 1)) / sizeof(uint32_t);
+}
+
+/**
+ * @brief Delivers the next parameter set without a request (feed has to be paused).
+ *
+ * Returns once the set is delivered or the TX FIFO is full (longer sets are completed
+ * while the state machine pulls).
+ */
+void param_feed_deliver_now(param_feed_t *feed) {
+    dma_channel_start(feed->ctrl_chan);
+    while (dma_channel_is_busy(feed->ctrl_chan) || dma_channel_is_busy(feed->desc_chan)) {
+        tight_loop_contents();
+    }
+    while (dma_channel_is_busy(feed->data_chan) && !pio_sm_is_tx_fifo_full(feed->pio, feed->sm)) {
+        tight_loop_contents();
+    }
+}
+
+
+/**
+ * @brief A pulsegen PIO program together with the entry points used by the C code.
+ *
+ * All variants share the structure of `pulsegen.pio`: `rearm`, `request` (requests the next
+ * parameter set with a `push`, pulls its cooldown word and waits for the cooldown),
+ * `recover_parameters` (pulls the rest of the set) and `wait_trigger`. Every set starts with
+ * the cooldown word.
+ *
+ * `min_offset` and `min_spacing` are the minimums the instructions of the variant impose, the
+ * offset loop count of a set is offset - min_offset. Variants with a public `spacing_loop` take
+ * the spacing prescaler of channel 0 (see pulsegen_patch_prescaler()).
+ */
+typedef struct {
+    const pio_program_t *program;
+    pio_sm_config (*get_default_config)(uint offset);
+    uint offset_rearm;
+    uint offset_request;
+    uint offset_wait_trigger;
+    int offset_spacing_loop; // -1 if the spacing is not prescaled
+    uint32_t min_offset;
+    uint32_t min_spacing;
+    uint32_t max_spacing_count; // Largest spacing loop count of a set
+    uint32_t max_length_count; // Largest length loop count of a set
+} pulsegen_variant_t;
+
+// Uniform trains: [cooldown, offset, combined] per trigger
+const pulsegen_variant_t variant_uniform = {
+    .program = &pulsegen_program,
+    .get_default_config = pulsegen_program_get_default_config,
+    .offset_rearm = pulsegen_offset_rearm,
+    .offset_request = pulsegen_offset_request,
+    .offset_wait_trigger = pulsegen_offset_wait_trigger,
+    .offset_spacing_loop = -1,
+    .min_offset = MIN_OFFSET,
+    .min_spacing = MIN_SPACING,
+    .max_spacing_count = SPACING_FIELD_MAX,
+    .max_length_count = LENGTH_FIELD_MAX
+};
+
+// Per-pulse schedules: [cooldown, offset, pulse 0, ..., terminator] per trigger
+const pulsegen_variant_t variant_schedule = {
+    .program = &pulsegen_schedule_program,
+    .get_default_config = pulsegen_schedule_program_get_default_config,
+    .offset_rearm = pulsegen_schedule_offset_rearm,
+    .offset_request = pulsegen_schedule_offset_request,
+    .offset_wait_trigger = pulsegen_schedule_offset_wait_trigger,
+    .offset_spacing_loop = -1,
+    .min_offset = MIN_OFFSET,
+    .min_spacing = MIN_SPACING,
+    .max_spacing_count = SPACING_FIELD_MAX,
+    .max_length_count = LENGTH_FIELD_MAX
+};
+
+// Uniform trains at several offsets: [cooldown, offset, combined, delta 1, ..., terminator] per trigger
+const pulsegen_variant_t variant_burst = {
+    .program = &pulsegen_burst_program,
+    .get_default_config = pulsegen_burst_program_get_default_config,
+    .offset_rearm = pulsegen_burst_offset_rearm,
+    .offset_request = pulsegen_burst_offset_request,
+    .offset_wait_trigger = pulsegen_burst_offset_wait_trigger,
+    .offset_spacing_loop = pulsegen_burst_offset_spacing_loop,
+    .min_offset = MIN_OFFSET,
+    .min_spacing = MIN_SPACING,
+    .max_spacing_count = SPACING_FIELD_MAX,
+    .max_length_count = LENGTH_FIELD_MAX
+};
+
+// Single pulses (repeats = 0): [cooldown, offset, length] per trigger
+const pulsegen_variant_t variant_single = {
+    .program = &pulsegen_single_program,
+    .get_default_config = pulsegen_single_program_get_default_config,
+    .offset_rearm = pulsegen_single_offset_rearm,
+    .offset_request = pulsegen_single_offset_request,
+    .offset_wait_trigger = pulsegen_single_offset_wait_trigger,
+    .offset_spacing_loop = -1,
+    .min_offset = SINGLE_MIN_OFFSET,
+    .min_spacing = 0, // No spacing after the pulse
+    .max_spacing_count = UINT32_MAX,
+    .max_length_count = UINT32_MAX - MIN_LENGTH // Length has a word of its own
+};
+
+// Uniform trains with repeats > 0: [cooldown, offset, spacing, repeats/length] per trigger
+const pulsegen_variant_t variant_train = {
+    .program = &pulsegen_train_program,
+    .get_default_config = pulsegen_train_program_get_default_config,
+    .offset_rearm = pulsegen_train_offset_rearm,
+    .offset_request = pulsegen_train_offset_request,
+    .offset_wait_trigger = pulsegen_train_offset_wait_trigger,
+    .offset_spacing_loop = pulsegen_train_offset_spacing_loop,
+    .min_offset = MIN_OFFSET,
+    .min_spacing = TRAIN_MIN_SPACING,
+    .max_spacing_count = UINT32_MAX, // Spacing has a word of its own
+    .max_length_count = LENGTH_FIELD_MAX // Same length limit as the combined word of the other trains
+};
+
+/**
+ * @brief A pulsegen state machine together with the DMA feed of its parameters.
+ */
+typedef struct {
+    PIO pio;
+    uint sm;
+    const pulsegen_variant_t *variant; // Loaded program
+    uint program_offset;
+    uint32_t prescaler; // Spacing loop multiplier patched into the loaded program
+    uint pin; // Output pin
+    param_feed_t feed;
+} pulsegen_t;
+
+
+/**
+ * @brief Packs three separate parameters into a single 32-bit word.
+ *
+ * This function combines three values — `repeats`, `spacing`, and `length` —
+ * into a single `uint32_t` by assigning specific bit fields:
+ *
+ * - `repeats`: PULSEGEN_REPEATS_BITS (5 by default, bits 0–4)
+ * - `length`:  PULSEGEN_LENGTH_BITS  (7 by default, bits 5–11)
+ * - `spacing`: PULSEGEN_SPACING_BITS (20 by default, bits 12–31)
+ *
+ * check_params() rejects values that do not fit, the clamps only guard the neighbouring fields.
+ *
+ * @param repeats   Number of repetitions (max REPEATS_FIELD_MAX).
+ * @param spacing   Spacing loop count (max SPACING_FIELD_MAX).
+ * @param length    Length loop count (max LENGTH_FIELD_MAX).
+ * @return          A 32-bit word encoding all three parameters.
+ */
+uint32_t pack_combined_parameters(uint repeats, uint spacing, uint length) {
+    if (repeats > REPEATS_FIELD_MAX) repeats = REPEATS_FIELD_MAX;
+    if (spacing > SPACING_FIELD_MAX) spacing = SPACING_FIELD_MAX;
+    if (length > LENGTH_FIELD_MAX) length = LENGTH_FIELD_MAX;
+
+    return ((uint32_t)spacing << SPACING_SHIFT) | ((uint32_t)length << LENGTH_SHIFT) | repeats;
+}
+
+/**
+ * @brief Packs repeats and length into the repeats/length word of pulsegen_train.pio.
+ *
+ * - `repeats`: PULSEGEN_REPEATS_BITS (bits 0–4 by default)
+ * - `length`:  the bits above, limited to LENGTH_FIELD_MAX like in pack_combined_parameters()
+ *
+ * @param repeats   Number of repetitions (max REPEATS_FIELD_MAX).
+ * @param length    Length loop count (max LENGTH_FIELD_MAX).
+ * @return          The repeats/length word.
+ */
+uint32_t pack_train_parameters(uint repeats, uint length) {
+    if (repeats > REPEATS_FIELD_MAX) repeats = REPEATS_FIELD_MAX;
+    if (length > LENGTH_FIELD_MAX) length = LENGTH_FIELD_MAX;
+
+    return ((uint32_t)length << LENGTH_SHIFT) | repeats;
+}
+
+
+/**
+ * @brief Re-arms an idle pulsegen state machine with the next parameter set of its feed.
+ *
+ * If the state machine waits for a trigger, it is stopped and its PC checked again: a stopped
+ * SM cannot leave `wait_trigger`, so no train can start between the check and the exec. Its
+ * FIFO is flushed (it does not pull before the next request), the feed delivers the next set
+ * and the SM is sent to `rearm` before it is enabled again. That skips the cooldown word and
+ * falls through to recover_parameters. Only the qualified edge (IRQ flag 0) starts a train, the
+ * trigger pin is not looked at: an edge that arrives meanwhile stays raised while the trigger
+ * is high and is served with the new set. A train that started between both checks
+ * is held for the few cycles of the second one and continues with the old set; the new set is
+ * picked up by its request.
+ *
+ * Must be called with interrupts disabled.
+ *
+ * @return true if the state machine was re-armed.
+ */
+bool rearm_if_idle(pulsegen_t *pg) {
+    uint wait_trigger_pc = pg->program_offset + pg->variant->offset_wait_trigger;
+    if (pio_sm_get_pc(pg->pio, pg->sm) != wait_trigger_pc) {
+        return false;
+    }
+    pio_sm_set_enabled(pg->pio, pg->sm, false);
+    if (pio_sm_get_pc(pg->pio, pg->sm) != wait_trigger_pc) {
+        pio_sm_set_enabled(pg->pio, pg->sm, true); // Triggered between both checks
+        return false;
+    }
+    param_feed_pause(&pg->feed);
+    param_feed_flush(&pg->feed); // Rest of a schedule the SM already started to pull
+    pio_sm_clear_fifos(pg->pio, pg->sm);
+    param_feed_deliver_now(&pg->feed);
+    pio_sm_exec(pg->pio, pg->sm, pio_encode_jmp(pg->program_offset + pg->variant->offset_rearm));
+    pio_sm_set_enabled(pg->pio, pg->sm, true);
+    param_feed_resume(&pg->feed);
+    return true;
+}
+
+/**
+ * @brief Stages a new parameter set without restarting the PIO state machine.
+ *
+ * The set is committed to the double-buffered slots of the feed. The state machine picks it
+ * up at its next recover_parameters boundary, so trains in flight finish with the old
+ * parameters and no trigger is missed.
+ *
+ * If the state machine is idle (waiting for a trigger), it is re-armed right away by
+ * rearm_if_idle(), so the next trigger already uses the new parameters. Otherwise they take
+ * effect after the train in flight (or latest after the following trigger if its set was
+ * already fetched).
+ *
+ * @param pg        The pulsegen state machine.
+ * @param set       Parameter set in the format of the loaded variant.
+ * @param words     Length of the set.
+ */
+void pulsegen_update(pulsegen_t *pg, const uint32_t *set, uint words) {
+    uint32_t irq_status = save_and_disable_interrupts();
+    param_feed_commit(&pg->feed, set, words);
+    rearm_if_idle(pg);
+    restore_interrupts(irq_status);
+}
+
+/**
+ * @brief Stages new uniform train parameters via pulsegen_update().
+ *
+ * @param pg        The pulsegen state machine (running the uniform variant).
+ * @param cooldown  Cooldown loop count.
+ * @param offset    Offset loop count.
+ * @param length    Length parameter for timing configuration.
+ * @param spacing   Spacing parameter for timing configuration.
+ * @param repeats   Repeat count for timing configuration.
+ */
+void update_delay(pulsegen_t *pg, uint32_t cooldown, uint32_t offset, uint length, uint spacing, uint repeats) {
+    uint32_t set[FEED_UNIFORM_WORDS] = {
+        cooldown,
+        offset,
+        pack_combined_parameters(repeats, spacing, length) // Combine parameters into single word
+    };
+    pulsegen_update(pg, set, FEED_UNIFORM_WORDS);
+}
+
+void init_pulsegen_pio(PIO pio, uint sm, uint program_offset, const pulsegen_variant_t *variant, uint pin) {
+    // Configure pin directions
+    gpio_pull_down(TRIGGER_PIN);
+    pio_gpio_init(pio, TRIGGER_PIN);   // input trigger pin
+    pio_gpio_init(pio, pin);    // output trigger pin
+    gpio_set_drive_strength(pin, GPIO_DRIVE_STRENGTH_12MA);
+
+    // Set input and sideset bases
+    pio_sm_config c = variant->get_default_config(program_offset);
+    // sm_config_set_in_pins(&c, TRIGGER_PIN);
+    // sm_config_set_out_pins(&c, pin, 1);
+    pio_sm_set_consecutive_pindirs(pio, sm, pin, 1, true);  // output pin
+    sm_config_set_sideset_pins(&c, pin);
+    sm_config_set_clkdiv(&c, 1.0f);  // Full speed: one instruction per system clock cycle (see set_system_clock())
+
+    // FIFOs are not joined: RX carries the parameter requests, TX the parameter sets (see param_feed_t)
+
+    pio_sm_init(pio, sm, program_offset + variant->offset_request, &c); // Initialize state machine (requests the first set)
+}
+
+/**
+ * @brief Writes `pg->prescaler` into the delay of the `spacing_loop` instruction of the loaded program.
+ *
+ * Every iteration of the spacing loop then takes `prescaler` cycles. The instruction memory
+ * is write-only, so the instruction is encoded again (side-set 0, relocated jump target).
+ */
+void pulsegen_patch_prescaler(pulsegen_t *pg) {
+    if (pg->variant->offset_spacing_loop < 0) {
+        return;
+    }
+    uint addr = pg->program_offset + (uint)pg->variant->offset_spacing_loop;
+    pg->pio->instr_mem[addr] = pio_encode_jmp_y_dec(addr) | pio_encode_sideset(1, 0) | pio_encode_delay(pg->prescaler - 1);
+}
+
+/**
+ * @brief Loads a pulsegen variant and initializes the state machine with it (left disabled).
+ *
+ * The spacing loop of the variant is prescaled by `pg->prescaler`. In one-shot mode the state
+ * machine starts disarmed on the `pull` after `request` instead (see oneshot_arm()).
+ */
+void pulsegen_load(pulsegen_t *pg, const pulsegen_variant_t *variant) {
+    pg->variant = variant;
+    pg->program_offset = pio_add_program(pg->pio, variant->program);
+    pulsegen_patch_prescaler(pg);
+    init_pulsegen_pio(pg->pio, pg->sm, pg->program_offset, variant, pg->pin);
+    if (pg->feed.one_shot) {
+        pio_sm_exec(pg->pio, pg->sm, pio_encode_jmp(pg->program_offset + variant->offset_request + 1));
+    } else {
+        stats_served[0]--; // The first request is not a served trigger
+    }
+}
+
+/**
+ * @brief Stops the state machine and replaces its program with `variant`.
+ *
+ * The state machine is left disabled at `request` and the feed paused. Must be called with
+ * interrupts disabled.
+ */
+void pulsegen_swap_program(pulsegen_t *pg, const pulsegen_variant_t *variant) {
+    pio_sm_set_enabled(pg->pio, pg->sm, false);
+    param_feed_pause(&pg->feed);
+    param_feed_flush(&pg->feed);
+    pio_remove_program(pg->pio, pg->variant->program, pg->program_offset);
+    pulsegen_load(pg, variant); // Clears the FIFOs
+}
+
+/**
+ * @brief Whether a swapped program has to be re-armed in one-shot mode: a shot is armed and
+ *        did not fire yet (its request is not pending in DMA_IRQ_0).
+ *
+ * A shot whose train was cut off by the swap stays armed.
+ */
+bool oneshot_pending(const pulsegen_t *pg) {
+    return pg->feed.one_shot && oneshot_armed && !dma_channel_get_irq0_status(pg->feed.req_chan);
+}
+
+/**
+ * @brief Delivers the next set to a state machine that waits at the `pull` of `request`
+ *        (one-shot mode, see oneshot_arm()).
+ */
+void pulsegen_deliver_shot(pulsegen_t *pg) {
+    param_feed_pause(&pg->feed);
+    param_feed_deliver_now(&pg->feed);
+    param_feed_resume(&pg->feed);
+}
+
+/**
+ * @brief Replaces the loaded pulsegen variant, starting it with `set`.
+ *
+ * The variants do not fit into the instruction memory together, so the state machine is
+ * stopped while the program is swapped; triggers during the swap (a few µs) are missed.
+ *
+ * @param set       First parameter set in the format of `variant`.
+ * @param words     Length of the set.
+ */
+void pulsegen_set_variant(pulsegen_t *pg, const pulsegen_variant_t *variant, const uint32_t *set, uint words) {
+    uint32_t irq_status = save_and_disable_interrupts();
+    bool rearm = oneshot_pending(pg);
+    pulsegen_swap_program(pg, variant);
+    param_feed_commit(&pg->feed, set, words);
+    param_feed_resume(&pg->feed); // The state machine starts with a request
+    if (rearm) {
+        pulsegen_deliver_shot(pg);
+    }
+    pio_sm_set_enabled(pg->pio, pg->sm, true);
+    restore_interrupts(irq_status);
+}
+
+/**
+ * @brief A trigger_qualifier program together with its entry point.
+ *
+ * All qualifiers raise IRQ flag 0 for the pulsegen SMs of their block and push every raised
+ * edge into the RX FIFO. They are started at `wait_low`, so both PIO blocks begin counting on
+ * the same edge even if the trigger is high at that moment.
+ */
+typedef struct {
+    const pio_program_t *program;
+    pio_sm_config (*get_default_config)(uint offset);
+    uint offset_wait_low;
+} qualifier_variant_t;
+
+// Every edge
+const qualifier_variant_t qualifier_plain = {
+    .program = &trigger_qualifier_program,
+    .get_default_config = trigger_qualifier_program_get_default_config,
+    .offset_wait_low = trigger_qualifier_offset_wait_low
+};
+
+// Every (skip + 1)th edge, no extra latency
+const qualifier_variant_t qualifier_skip = {
+    .program = &trigger_qualifier_skip_program,
+    .get_default_config = trigger_qualifier_skip_program_get_default_config,
+    .offset_wait_low = trigger_qualifier_skip_offset_wait_low
+};
+
+// Edges of at least `width` cycles, `width` cycles later (with a skip count)
+const qualifier_variant_t qualifier_width = {
+    .program = &trigger_qualifier_width_program,
+    .get_default_config = trigger_qualifier_width_program_get_default_config,
+    .offset_wait_low = trigger_qualifier_width_offset_wait_low
+};
+
+// Matches of a sample pattern instead of edges (started at its first instruction)
+const qualifier_variant_t qualifier_pattern = {
+    .program = &trigger_pattern_program,
+    .get_default_config = trigger_pattern_program_get_default_config,
+    .offset_wait_low = trigger_pattern_offset_sample
+};
+
+/**
+ * @brief Trigger qualification of all channels as set by the host.
+ */
+typedef struct {
+    uint32_t skip;  // Edges ignored before every qualified edge (0: every edge)
+    uint32_t width; // Minimum high time of an edge in cycles (below QUALIFIER_MIN_WIDTH: no filter)
+    uint32_t pattern;        // Trigger on these samples of the trigger input (newest sample in bit 0)
+    uint32_t pattern_bits;   // Samples of the pattern (0: edge trigger, skip and width apply)
+    uint32_t pattern_period; // Cycles between two samples (PATTERN_MIN_PERIOD to PATTERN_MAX_PERIOD)
+} qualifier_params_t;
+
+/**
+ * @brief The qualifier SMs of both PIO blocks (pio1 only has one if it runs pulse channels).
+ */
+typedef struct {
+    const qualifier_variant_t *variant; // Loaded on both blocks
+    qualifier_params_t params;          // Parameters the variant was loaded with
+    bool used[2];                       // Per PIO block
+    uint program_offset[2];
+} qualifier_t;
+
+qualifier_params_t qualifier_params; // Qualification of the trigger, written by core1 (see control_call())
+qualifier_t qualifier; // Owned by core0
+bool trigger_hold = false; // Qualifiers stopped after a clock loss until the host sets a clock (see clock_task()), owned by core0
+
+/**
+ * @brief Selects the qualifier program for the qualification parameters.
+ */
+const qualifier_variant_t *qualifier_variant(const qualifier_params_t *params) {
+    if (params->pattern_bits > 0) {
+        return &qualifier_pattern;
+    }
+    if (params->width >= QUALIFIER_MIN_WIDTH) {
+        return &qualifier_width;
+    }
+    return params->skip ? &qualifier_skip : &qualifier_plain;
+}
+
+/**
+ * @brief Checks qualification parameters set by the host.
+ *
+ * A pattern replaces the edge trigger, so skip count and width filter are not used with it.
+ *
+ * @return Key of the first invalid value ('q' width, 'n' pattern length, 'x' pattern wider than
+ *         its length, 'b' sample period, 'k' skip count next to a pattern), 0 if all are valid.
+ */
+char check_qualifier(const qualifier_params_t *params) {
+    if (params->width > QUALIFIER_MAX_WIDTH) {
+        return 'q';
+    }
+    if (params->pattern_bits > PATTERN_MAX_BITS) {
+        return 'n';
+    }
+    if (params->pattern_bits == 0) {
+        return 0;
+    }
+    if (params->pattern_bits < 32 && (params->pattern >> params->pattern_bits) != 0) {
+        return 'x';
+    }
+    if (params->pattern_period < PATTERN_MIN_PERIOD || params->pattern_period > PATTERN_MAX_PERIOD) {
+        return 'b';
+    }
+    if (params->skip > 0 || params->width >= QUALIFIER_MIN_WIDTH) {
+        return 'k';
+    }
+    return 0;
+}
+
+/**
+ * @brief Initializes the trigger qualifier of a PIO block (left disabled, see qualifier_enable()).
+ *
+ * The skip count is loaded into OSR and x through the TX FIFO before it is joined to RX, the
+ * width filter is patched into the delay of `edge` of trigger_qualifier_width.pio. For
+ * trigger_pattern.pio the pattern is loaded into y instead, its length patched into `compare`
+ * and the sample period set with the clock divider (fractional dividers spread the remainder
+ * of period / PATTERN_LOOP_CYCLES over the samples). The qualifier must be running before the
+ * pulsegen SMs of the block are enabled, otherwise they never see a trigger.
+ */
+void init_trigger_qualifier_pio(PIO pio, uint sm, uint program_offset, const qualifier_variant_t *variant,
+                                const qualifier_params_t *params) {
+    gpio_pull_down(TRIGGER_PIN);
+    pio_gpio_init(pio, TRIGGER_PIN);   // input trigger pin
+
+    if (variant == &qualifier_width) {
+        pio->instr_mem[program_offset + trigger_qualifier_width_offset_edge] =
+            pio_encode_wait_gpio(true, TRIGGER_PIN) | pio_encode_delay(params->width - QUALIFIER_MIN_WIDTH);
+    }
+    bool pattern = (variant == &qualifier_pattern);
+    if (pattern) {
+        pio->instr_mem[program_offset + trigger_pattern_offset_compare] = pio_encode_out(pio_x, params->pattern_bits);
+    }
+    pio_sm_config c = variant->get_default_config(program_offset);
+    sm_config_set_clkdiv(&c, 1.0f);  // Full speed, same cycle as the pulsegen SMs
+    sm_config_set_jmp_pin(&c, TRIGGER_PIN); // Width check of trigger_qualifier_width.pio
+    if (pattern) {
+        sm_config_set_in_pins(&c, TRIGGER_PIN);
+        sm_config_set_in_shift(&c, false, false, 32); // Window of the last 32 samples, newest in bit 0
+        sm_config_set_out_shift(&c, true, false, 32); // `out x, N` takes the newest N samples
+        sm_config_set_clkdiv_int_frac(&c, params->pattern_period / PATTERN_LOOP_CYCLES,
+                                      (params->pattern_period % PATTERN_LOOP_CYCLES) * 256 / PATTERN_LOOP_CYCLES);
+    }
+
+    pio_sm_init(pio, sm, program_offset + variant->offset_wait_low, &c);
+    pio_sm_put(pio, sm, pattern ? params->pattern : params->skip);
+    pio_sm_exec(pio, sm, pio_encode_pull(false, true));
+    pio_sm_exec(pio, sm, pio_encode_mov(pattern ? pio_y : pio_x, pio_osr));
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX); // 8 edges of slack for the counting interrupt
+    pio_sm_set_config(pio, sm, &c);
+    pio_interrupt_clear(pio, 0);
+}
+
+/**
+ * @brief Loads the qualifier program for `params` into the used PIO blocks and initializes
+ *        their qualifier SMs (left disabled).
+ *
+ * The programs are loaded at offset 0, the pulsegen programs from the top of the instruction
+ * memory, so a program swap of channel 0 always finds the rest of it in one piece (see
+ * burst_fits()).
+ *
+ * @return false if the program does not fit next to the other programs of a block (nothing
+ *         is loaded then).
+ */
+bool qualifier_load(qualifier_t *q, const qualifier_params_t *params) {
+    const qualifier_variant_t *variant = qualifier_variant(params);
+    for (uint i = 0; i < 2; i++) {
+        if (q->used[i] && !pio_can_add_program_at_offset(i ? pio1 : pio0, variant->program, 0)) {
+            return false;
+        }
+    }
+    q->variant = variant;
+    q->params = *params;
+    for (uint i = 0; i < 2; i++) {
+        if (q->used[i]) {
+            PIO pio = i ? pio1 : pio0;
+            pio_add_program_at_offset(pio, variant->program, 0);
+            q->program_offset[i] = 0;
+            init_trigger_qualifier_pio(pio, QUALIFIER_SM, q->program_offset[i], variant, params);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Whether pulsegen_burst.pio fits next to the qualifier program for `params` on pio0.
+ *
+ * Only the skip count and width filter programs are too large, a pattern trigger fits.
+ */
+bool burst_fits(const qualifier_params_t *params) {
+    return qualifier_variant(params)->program->length + pulsegen_burst_program.length <= PIO_INSTRUCTION_COUNT;
+}
+
+/**
+ * @brief Starts the qualifiers of both PIO blocks right after each other.
+ *
+ * They start at `wait_low`, so only an edge within the few cycles between the two enables can
+ * be seen by one block and not the other.
+ */
+void qualifier_enable(const qualifier_t *q) {
+    if (trigger_hold) { // Started again by clock_release()
+        return;
+    }
+    uint32_t irq_status = save_and_disable_interrupts();
+    for (uint i = 0; i < 2; i++) {
+        if (q->used[i]) {
+            pio_sm_set_enabled(i ? pio1 : pio0, QUALIFIER_SM, true);
+        }
+    }
+    restore_interrupts(irq_status);
+}
+
+/**
+ * @brief Stops the qualifiers of both PIO blocks, the pulsegen SMs see no trigger until
+ *        qualifier_enable(). A train in flight is finished.
+ */
+void qualifier_disable(const qualifier_t *q) {
+    uint32_t irq_status = save_and_disable_interrupts();
+    for (uint i = 0; i < 2; i++) {
+        if (q->used[i]) {
+            PIO pio = i ? pio1 : pio0;
+            pio_sm_set_enabled(pio, QUALIFIER_SM, false);
+            pio_interrupt_clear(pio, 0); // Edge raised before the stop
+        }
+    }
+    restore_interrupts(irq_status);
+}
+
+/**
+ * @brief Pulse pattern of the stimulus generator as set by the host.
+ */
+typedef struct {
+    uint32_t pulses[STIMULUS_PATTERN_MAX_PULSES][2]; // [high, low] times in cycles
+    uint32_t len;     // Pulses of the pattern, 0 turns the generator off
+    uint32_t repeats; // Runs of the pattern, 0 for a continuous loop
+} stimulus_params_t;
+
+/**
+ * @brief Stimulus generator: trigger_test.pio fed by DMA.
+ *
+ * `data_chan` copies the loop counts of the pattern into the TX FIFO. For a continuous loop it
+ * chains to `ctrl_chan`, which writes the start of the pattern back into the read address
+ * trigger of `data_chan` (the transfer count is reloaded on every trigger).
+ */
+typedef struct {
+    PIO pio;                // NULL without ENABLE_TEST_PIN_PIO
+    uint sm;
+    uint program_offset;
+    int data_chan;          // Pattern -> TX FIFO
+    int ctrl_chan;          // Restarts data_chan at `loop_start` (continuous loop)
+    const uint32_t *loop_start; // Read by ctrl_chan
+    uint32_t counts[2 * STIMULUS_MAX_PULSES]; // [high, low] phase words (level | loop count << 1), the pattern repeated
+} stimulus_t;
+
+stimulus_params_t stimulus_params; // Pattern of the generator, written by core1 (see control_call())
+stimulus_t stimulus; // Owned by core0
+
+/**
+ * @brief Checks a stimulus pattern.
+ *
+ * @return false if a time is outside STIMULUS_MIN_CYCLES-STIMULUS_MAX_CYCLES or the repeated
+ *         pattern exceeds STIMULUS_MAX_PULSES.
+ */
+bool check_stimulus(const stimulus_params_t *params) {
+    if (params->len > STIMULUS_PATTERN_MAX_PULSES ||
+        (uint64_t)params->len * MAX(params->repeats, 1) > STIMULUS_MAX_PULSES) {
+        return false;
+    }
+    for (uint i = 0; i < params->len; i++) {
+        for (uint phase = 0; phase < 2; phase++) {
+            if (params->pulses[i][phase] < STIMULUS_MIN_CYCLES || params->pulses[i][phase] > STIMULUS_MAX_CYCLES) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Stops the stimulus generator, TEST_PIN is driven low.
+ */
+void stimulus_stop(stimulus_t *stim) {
+    pio_sm_set_enabled(stim->pio, stim->sm, false);
+    // An aborted channel can still trigger its chain (RP2040-E13), so unchain data_chan first
+    param_feed_set_chain(stim->data_chan, stim->data_chan);
+    dma_channel_abort(stim->ctrl_chan);
+    dma_channel_abort(stim->data_chan);
+    pio_sm_clear_fifos(stim->pio, stim->sm);
+    pio_sm_restart(stim->pio, stim->sm);
+    pio_sm_exec(stim->pio, stim->sm, pio_encode_mov(pio_pins, pio_null));
+    pio_sm_exec(stim->pio, stim->sm, pio_encode_jmp(stim->program_offset));
+}
+
+/**
+ * @brief (Re)starts the stimulus generator with a checked pattern (see check_stimulus()).
+ *
+ * The pattern starts with its first rising edge. A pattern with repeats stops after its last
+ * low time, TEST_PIN stays low. A pattern without pulses only stops the generator.
+ */
+void stimulus_start(stimulus_t *stim, const stimulus_params_t *params) {
+    stimulus_stop(stim);
+    if (params->len == 0) {
+        return;
+    }
+    uint runs = MAX(params->repeats, 1);
+    uint words = 0;
+    for (uint run = 0; run < runs; run++) {
+        for (uint i = 0; i < params->len; i++) {
+            stim->counts[words++] = ((params->pulses[i][0] - STIMULUS_MIN_CYCLES) << 1) | 1;
+            stim->counts[words++] = (params->pulses[i][1] - STIMULUS_MIN_CYCLES) << 1;
+        }
+    }
+
+    dma_channel_config data_cfg = dma_channel_get_default_config(stim->data_chan);
+    channel_config_set_transfer_data_size(&data_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&data_cfg, true);
+    channel_config_set_write_increment(&data_cfg, false);
+    channel_config_set_dreq(&data_cfg, pio_get_dreq(stim->pio, stim->sm, true));
+    channel_config_set_chain_to(&data_cfg, params->repeats ? stim->data_chan : stim->ctrl_chan);
+    dma_channel_configure(stim->data_chan, &data_cfg, &stim->pio->txf[stim->sm], stim->counts, words, true);
+    pio_sm_set_enabled(stim->pio, stim->sm, true);
+}
+
+/**
+ * @brief Claims the DMA channels of the stimulus generator and starts it with `params`.
+ */
+void stimulus_init(stimulus_t *stim, PIO pio, uint sm, uint program_offset, const stimulus_params_t *params) {
+    stim->pio = pio;
+    stim->sm = sm;
+    stim->program_offset = program_offset;
+    stim->loop_start = stim->counts;
+    stim->data_chan = dma_claim_unused_channel(true);
+    stim->ctrl_chan = dma_claim_unused_channel(true);
+
+    pio_sm_config c = trigger_test_program_get_default_config(program_offset);
+    sm_config_set_clkdiv(&c, 1.0f);  // Times in cycles of the system clock
+    sm_config_set_out_shift(&c, true, true, 32); // Autopull: one phase word per phase
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX); // 4 pulses of slack for the DMA
+
+    pio_gpio_init(pio, TEST_PIN); // Init TEST_PIN GPIO
+    sm_config_set_out_pins(&c, TEST_PIN, 1); // Set output pin
+    pio_sm_set_consecutive_pindirs(pio, sm, TEST_PIN, 1, true);  // Set as output
+    pio_sm_init(pio, sm, program_offset, &c); // Initialize state machine
+
+    dma_channel_config ctrl_cfg = dma_channel_get_default_config(stim->ctrl_chan);
+    channel_config_set_transfer_data_size(&ctrl_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl_cfg, false);
+    channel_config_set_write_increment(&ctrl_cfg, false);
+    dma_channel_configure(stim->ctrl_chan, &ctrl_cfg, &dma_hw->ch[stim->data_chan].al3_read_addr_trig,
+                          &stim->loop_start, 1, false);
+
+    stimulus_start(stim, params);
+}
+
+/**
+ * @brief Pulse generator parameters as set by the host (in clock cycles).
+ */
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t spacing;
+    uint32_t repeats;
+    uint32_t cooldown; // Cooldown loop count after the train (0 allowed)
+    uint32_t prescaler; // Spacing loop multiplier (1-MAX_PRESCALER), see effective_prescaler()
+} pulse_params_t;
+
+pulse_params_t channel_params[NUM_CHANNELS]; // Parameters of all channels, written by core1 (see control_call())
+
+/**
+ * @brief Looks up a parameter by its single character key.
+ *
+ * The keys ('o', 'l', 's', 'r', 'c', 'm') are shared by the ASCII commands and the
+ * parameter IDs of the binary frame protocol.
+ *
+ * @param params    Parameter set to look the key up in.
+ * @param key       Parameter key.
+ * @return          Pointer to the parameter inside `params`, NULL for an unknown key.
+ */
+uint32_t *param_by_key(pulse_params_t *params, char key) {
+    switch (key) {
+        case 'o': return &params->offset;
+        case 'l': return &params->length;
+        case 's': return &params->spacing;
+        case 'r': return &params->repeats;
+        case 'c': return &params->cooldown;
+        case 'm': return &params->prescaler;
+        default: return NULL;
+    }
+}
+
+/**
+ * @brief Returns the spacing prescaler a variant runs `params` with.
+ *
+ * Only variants with a prescaled `spacing_loop` (fixed trains and bursts of channel 0) use the
+ * prescaler, all others count the spacing in single cycles.
+ */
+uint32_t effective_prescaler(const pulse_params_t *params, const pulsegen_variant_t *variant) {
+    return (variant->offset_spacing_loop >= 0) ? params->prescaler : 1;
+}
+
+/**
+ * @brief Returns the smallest spacing of a variant in cycles for a prescaler.
+ */
+uint32_t min_spacing(const pulsegen_variant_t *variant, uint32_t prescaler) {
+    return variant->min_spacing + prescaler - 1;
+}
+
+/**
+ * @brief Converts the spacing of `params` into the spacing loop count of a variant.
+ *
+ * A spacing is min_spacing() + count * prescaler cycles, spacings between two steps are
+ * rounded down (see quantize_spacing()).
+ *
+ * @param params    Parameter set checked for `variant`.
+ */
+uint32_t spacing_count(const pulse_params_t *params, const pulsegen_variant_t *variant) {
+    uint32_t prescaler = effective_prescaler(params, variant);
+    return (params->spacing - min_spacing(variant, prescaler)) / prescaler;
+}
+
+/**
+ * @brief Checks a parameter set against the limits imposed by a pulsegen variant.
+ *
+ * @param params    Parameter set to check.
+ * @param variant   Variant the set is built for (&variant_uniform for sweep points and the
+ *                  additional channels).
+ * @return          0 if all parameters are valid, otherwise the key of the first invalid parameter.
+ */
+char check_params(const pulse_params_t *params, const pulsegen_variant_t *variant) {
+    if (params->prescaler < 1 || params->prescaler > MAX_PRESCALER) return 'm';
+    if (params->offset < variant->min_offset) return 'o';
+    if (params->length < MIN_LENGTH || params->length - MIN_LENGTH > variant->max_length_count) return 'l';
+    if (params->repeats > REPEATS_FIELD_MAX) return 'r';
+    if (params->spacing < min_spacing(variant, effective_prescaler(params, variant))) return 's';
+    if (spacing_count(params, variant) > variant->max_spacing_count) return 'S';
+    return 0;
+}
+
+/**
+ * @brief Rounds the spacing of checked parameters down to the step of the prescaler in use.
+ *
+ * So the stored spacing (`G s`) is the one the state machine produces.
+ */
+void quantize_spacing(pulse_params_t *params, const pulsegen_variant_t *variant) {
+    uint32_t prescaler = effective_prescaler(params, variant);
+    params->spacing -= (params->spacing - min_spacing(variant, prescaler)) % prescaler;
+}
+
+/**
+ * @brief Returns the duration of a uniform train in cycles, from its first rising edge to the
+ *        end of the spacing after its last pulse.
+ *
+ * Uses the packed fields, so clamped parameters are accounted for like in the state machine.
+ */
+uint64_t train_cycles(const pulse_params_t *params) {
+    uint32_t prescaler = effective_prescaler(params, &variant_burst);
+    uint32_t combined = pack_combined_parameters(params->repeats, spacing_count(params, &variant_burst), params->length - MIN_LENGTH);
+    uint64_t repeats = combined & REPEATS_FIELD_MAX;
+    uint64_t length = ((combined >> LENGTH_SHIFT) & LENGTH_FIELD_MAX) + MIN_LENGTH;
+    uint64_t spacing = (uint64_t)((combined >> SPACING_SHIFT) & SPACING_FIELD_MAX) * prescaler + min_spacing(&variant_burst, prescaler);
+    return (repeats + 1) * (length + spacing);
+}
+
+/**
+ * @brief Checks burst offsets against the trains configured in `params`.
+ *
+ * @param params    Valid parameter set (see check_params()).
+ * @param offsets   Absolute train offsets in cycles.
+ * @param count     Number of offsets (0: burst mode off, always valid).
+ * @return          0 if valid, 'o' if the first offset is below MIN_OFFSET, 'b' if two trains
+ *                  are less than the train duration plus BURST_MIN_GAP apart.
+ */
+char check_burst(const pulse_params_t *params, const uint32_t *offsets, uint32_t count) {
+    if (count > 0 && offsets[0] < MIN_OFFSET) return 'o';
+    uint64_t min_gap = train_cycles(params) + BURST_MIN_GAP;
+    for (uint32_t i = 1; i < count; i++) {
+        if (offsets[i] < offsets[i - 1] || offsets[i] - offsets[i - 1] < min_gap) return 'b';
+    }
+    return 0;
+}
+
+/**
+ * @brief Builds the parameter set of pulsegen_burst.pio from absolute offsets.
+ *
+ * The first offset is handled like the offset of a uniform train. Every following train
+ * is delayed by a delta counted after the previous train: gap - train duration - 7 cycles
+ * of burst overhead (pull, branch, restore and the offset loop exit), always >= 1 because
+ * 0 is the terminator.
+ *
+ * @param params    Valid parameter set, offsets checked with check_burst().
+ * @param set       Destination, at least count + 3 words.
+ * @return          Length of the set.
+ */
+uint burst_to_set(const pulse_params_t *params, const uint32_t *offsets, uint32_t count, uint32_t *set) {
+    uint32_t train = (uint32_t)train_cycles(params);
+    set[0] = params->cooldown;
+    set[1] = offsets[0] - MIN_OFFSET;
+    set[2] = pack_combined_parameters(params->repeats, spacing_count(params, &variant_burst), params->length - MIN_LENGTH);
+    for (uint32_t i = 1; i < count; i++) {
+        set[i + 2] = offsets[i] - offsets[i - 1] - train - (BURST_MIN_GAP - 1);
+    }
+    set[count + 2] = 0; // Terminator
+    return count + 3;
+}
+
+/**
+ * @brief Prints the ASCII error message for a parameter rejected by check_params().
+ *
+ * @param params    Rejected parameters.
+ * @param variant   Variant the parameters were checked for.
+ */
+void print_param_error(char key, const pulse_params_t *params, const pulsegen_variant_t *variant) {
+    uint32_t prescaler = effective_prescaler(params, variant);
+    switch (key) {
+        case 'o': printf("min_offset=%u", variant->min_offset); break;
+        case 'l': printf("min_length=%u max_length=%llu", MIN_LENGTH, MIN_LENGTH + (unsigned long long)variant->max_length_count); break;
+        case 'r': printf("max_repeats=%u", REPEATS_FIELD_MAX); break;
+        case 's': printf("min_spacing=%u", min_spacing(variant, prescaler)); break;
+        case 'S': printf("max_spacing=%llu", min_spacing(variant, prescaler) + (unsigned long long)variant->max_spacing_count * prescaler); break;
+        case 'm': printf("prescaler=1-%u", MAX_PRESCALER); break;
+        case 'b': printf("min_burst_gap=train+%u", BURST_MIN_GAP); break;
+        default: break;
+    }
+}
+
+/**
+ * @brief Converts host parameters into the [offset, combined] pair of a sweep point.
+ *
+ * @param params    Valid parameter set (see check_params()).
+ * @param pair      Destination for the offset loop count and the packed combined word.
+ */
+void params_to_pair(const pulse_params_t *params, uint32_t *pair) {
+    pair[0] = params->offset - MIN_OFFSET;
+    pair[1] = pack_combined_parameters(params->repeats, params->spacing - MIN_SPACING, params->length - MIN_LENGTH);
+}
+
+/**
+ * @brief Converts host parameters into the [cooldown, offset, combined] set consumed by pulsegen.pio.
+ *
+ * @param params    Valid parameter set (see check_params()).
+ * @param set       Destination, FEED_UNIFORM_WORDS words.
+ */
+void params_to_set(const pulse_params_t *params, uint32_t *set) {
+    set[0] = params->cooldown;
+    params_to_pair(params, &set[1]);
+}
+
+/**
+ * @brief Converts host parameters into the [cooldown, offset, length] set of pulsegen_single.pio.
+ *
+ * @param params    Parameter set checked for variant_single.
+ * @param set       Destination, FEED_SINGLE_WORDS words.
+ */
+void params_to_single_set(const pulse_params_t *params, uint32_t *set) {
+    set[0] = params->cooldown;
+    set[1] = params->offset - SINGLE_MIN_OFFSET;
+    set[2] = params->length - MIN_LENGTH;
+}
+
+/**
+ * @brief Converts host parameters into the [cooldown, offset, spacing, repeats/length] set of
+ *        pulsegen_train.pio.
+ *
+ * @param params    Parameter set checked for variant_train.
+ * @param set       Destination, FEED_TRAIN_WORDS words.
+ */
+void params_to_train_set(const pulse_params_t *params, uint32_t *set) {
+    set[0] = params->cooldown;
+    set[1] = params->offset - MIN_OFFSET;
+    set[2] = spacing_count(params, &variant_train);
+    set[3] = pack_train_parameters(params->repeats, params->length - MIN_LENGTH);
+}
+
+/**
+ * @brief An additional pulse output running the uniform pulsegen variant.
+ *
+ * A request driven param_feed_t takes 4 of the 12 DMA channels, so additional outputs use
+ * two DMA channels instead: `data_chan` copies the [cooldown, offset, combined] set of the
+ * channel into the TX FIFO (paced by the TX FIFO) and chains to `ctrl_chan`, which restarts
+ * it at the beginning of `set`. So every request pulls the current set without CPU
+ * involvement. The parameter requests of the state machine are only counted (see
+ * stats_irq_handler()).
+ *
+ * The TX FIFO holds prefetched words, so a new set is switched in while the state machine
+ * waits for a trigger (see channel_swap_if_idle()).
+ */
+typedef struct {
+    PIO pio;
+    uint sm;
+    uint channel; // Channel number (1 for channels[0])
+    uint program_offset;
+    uint pin;
+    int data_chan;
+    int ctrl_chan;
+    uint32_t set[FEED_UNIFORM_WORDS]; // Streamed by data_chan
+    const uint32_t *set_addr; // Start of `set`, written to data_chan by ctrl_chan
+    uint32_t next_set[FEED_UNIFORM_WORDS]; // Set staged by channel_update()
+    volatile bool pending; // next_set waits for the state machine to become idle
+} pulse_channel_t;
+
+/**
+ * @brief PIO block of an additional channel: free SMs of pio1 first, then the remaining SMs of pio0.
+ */
+PIO channel_pio(uint channel) {
+    return (channel <= PIO1_CHANNELS) ? pio1 : pio0;
+}
+
+/**
+ * @brief State machine of an additional channel on channel_pio().
+ */
+uint channel_sm(uint channel) {
+    return (channel <= PIO1_CHANNELS) ? channel - 1 : channel - PIO1_CHANNELS;
+}
+
+/**
+ * @brief Counts and drops the parameter requests of an additional channel (one per train).
+ */
+void stats_count_requests(uint channel) {
+    PIO pio = channel_pio(channel);
+    uint sm = channel_sm(channel);
+    while (!pio_sm_is_rx_fifo_empty(pio, sm)) {
+        (void)pio_sm_get(pio, sm);
+        stats_served[channel]++;
+    }
+}
+
+/**
+ * @brief Counts trigger edges (qualifier of pio0) and the trains of the additional channels.
+ *
+ * Handles PIO0_IRQ_0 and PIO1_IRQ_0 (RX FIFO not empty of the counted SMs) on core0.
+ */
+void stats_irq_handler(void) {
+    while (!pio_sm_is_rx_fifo_empty(pio0, QUALIFIER_SM)) {
+        (void)pio_sm_get(pio0, QUALIFIER_SM);
+        stats_triggers++;
+    }
+    for (uint i = 1; i < NUM_CHANNELS; i++) {
+        stats_count_requests(i);
+    }
+}
+
+/**
+ * @brief Counts the parameter requests of channel 0 (DMA_IRQ_0, completion of req_chan).
+ *
+ * Two requests within one interrupt latency are counted once, which needs interrupts to be
+ * disabled for longer than a train and its cooldown. In one-shot mode the request marks the
+ * end of the armed shot, which is disarmed and reported to the host (see oneshot_arm()).
+ */
+void stats_dma_irq_handler(void) {
+    if (dma_channel_get_irq0_status(stats_req_chan)) {
+        dma_channel_acknowledge_irq0(stats_req_chan);
+        stats_served[0]++;
+        if (oneshot_armed) {
+            oneshot_armed = false;
+            oneshot_fired_us = time_us_32();
+            oneshot_fired_triggers = stats_triggers;
+            oneshot_fired_seq = oneshot_seq; // Written last, core1 reports once it changed
+            __sev(); // Wakes the command parser (command_wait_event())
+        }
+    }
+}
+
+/**
+ * @brief Enables the counting interrupts on the calling core (core0).
+ *
+ * @param req_chan  req_chan of the channel 0 feed.
+ */
+void stats_init(int req_chan) {
+    stats_req_chan = req_chan;
+    dma_channel_set_irq0_enabled(req_chan, true);
+    irq_set_exclusive_handler(DMA_IRQ_0, stats_dma_irq_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    pio_set_irq0_source_enabled(pio0, (enum pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + QUALIFIER_SM), true);
+    for (uint i = 1; i < NUM_CHANNELS; i++) {
+        pio_set_irq0_source_enabled(channel_pio(i), (enum pio_interrupt_source)(pis_sm0_rx_fifo_not_empty + channel_sm(i)), true);
+    }
+    irq_set_exclusive_handler(PIO0_IRQ_0, stats_irq_handler);
+    irq_set_exclusive_handler(PIO1_IRQ_0, stats_irq_handler);
+    irq_set_enabled(PIO0_IRQ_0, true);
+    irq_set_enabled(PIO1_IRQ_0, true);
+}
+
+/**
+ * @brief Replaces the trigger qualifiers of both PIO blocks for `params` (called on core0).
+ *
+ * The qualifiers are stopped and their program swapped (see qualifier_variant()), edges
+ * during the swap are missed and the skip count starts over. The pulsegen SMs keep waiting.
+ *
+ * @return false if the program does not fit next to the pulsegen program (skip count or width
+ *         filter in burst mode), the previous qualification stays active then.
+ */
+bool qualifier_apply(qualifier_t *q, const qualifier_params_t *params) {
+    uint32_t irq_status = save_and_disable_interrupts();
+    stats_irq_handler(); // Count the edges in the FIFO before it is cleared
+    for (uint i = 0; i < 2; i++) {
+        if (q->used[i]) {
+            PIO pio = i ? pio1 : pio0;
+            pio_sm_set_enabled(pio, QUALIFIER_SM, false);
+            pio_remove_program(pio, q->variant->program, q->program_offset[i]);
+        }
+    }
+    qualifier_params_t previous = q->params;
+    bool result = qualifier_load(q, params);
+    if (!result) {
+        qualifier_load(q, &previous);
+    }
+    qualifier_enable(q);
+    restore_interrupts(irq_status);
+    return result;
+}
+
+/**
+ * @brief Arms a single shot of channel 0, or leaves one-shot mode (called on core0).
+ *
+ * In one-shot mode the feed consumes the request at the end of a train without answering it
+ * (see param_feed_resume()), so the state machine stops at the `pull` of `request` after
+ * exactly one train. Arming delivers the next set, which is fired by the next trigger. The
+ * request of the shot raises DMA_IRQ_0, where stats_dma_irq_handler() disarms it and records
+ * its sequence number for the FIRED notification of core1.
+ *
+ * Entering one-shot mode restarts the program disarmed (a train in flight is cut off like in
+ * a program swap). An armed shot that did not fire yet stays armed with its sequence number.
+ * Leaving one-shot mode answers every request again. Additional channels are not affected.
+ *
+ * @param arm       true to arm a shot, false to leave one-shot mode.
+ * @return false with PIO0_SHARED (the program is shared with additional channels).
+ */
+bool oneshot_arm(pulsegen_t *pg, bool arm) {
+    if (PIO0_SHARED) {
+        return false;
+    }
+    uint32_t irq_status = save_and_disable_interrupts();
+    stats_dma_irq_handler(); // A shot that just fired is disarmed
+    param_feed_t *feed = &pg->feed;
+    if (arm) {
+        if (!feed->one_shot) {
+            feed->one_shot = true;
+            pulsegen_swap_program(pg, pg->variant); // Starts disarmed (see pulsegen_load())
+            param_feed_resume(feed);
+            pio_sm_set_enabled(pg->pio, pg->sm, true);
+        }
+        if (!oneshot_armed) {
+            oneshot_seq++;
+            oneshot_armed = true;
+            pulsegen_deliver_shot(pg);
+        }
+    } else if (feed->one_shot) {
+        param_feed_pause(feed);
+        feed->one_shot = false;
+        // A disarmed state machine waits for the answer to a request req_chan already consumed
+        if (pio_sm_get_pc(pg->pio, pg->sm) == pg->program_offset + pg->variant->offset_request + 1 &&
+            pio_sm_is_tx_fifo_empty(pg->pio, pg->sm) && pio_sm_is_rx_fifo_empty(pg->pio, pg->sm) &&
+            !dma_channel_is_busy(feed->data_chan)) {
+            param_feed_deliver_now(feed);
+        }
+        oneshot_armed = false;
+        param_feed_resume(feed);
+    }
+    restore_interrupts(irq_status);
+    return true;
+}
+
+/**
+ * @brief (Re)starts streaming `set` into the TX FIFO of the channel.
+ */
+void channel_stream_start(pulse_channel_t *ch) {
+    dma_channel_config ctrl_cfg = dma_channel_get_default_config(ch->ctrl_chan);
+    channel_config_set_transfer_data_size(&ctrl_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&ctrl_cfg, false);
+    channel_config_set_write_increment(&ctrl_cfg, false);
+    dma_channel_configure(ch->ctrl_chan, &ctrl_cfg, &dma_hw->ch[ch->data_chan].al3_read_addr_trig,
+                          &ch->set_addr, 1, false);
+
+    dma_channel_config data_cfg = dma_channel_get_default_config(ch->data_chan);
+    channel_config_set_transfer_data_size(&data_cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&data_cfg, true);
+    channel_config_set_write_increment(&data_cfg, false); // Always write to same PIO FIFO addr
+    channel_config_set_dreq(&data_cfg, pio_get_dreq(ch->pio, ch->sm, true)); // Throttle by PIO TX FIFO
+    channel_config_set_chain_to(&data_cfg, ch->ctrl_chan); // Start over with the same set
+    dma_channel_configure(ch->data_chan, &data_cfg, &ch->pio->txf[ch->sm], ch->set, FEED_UNIFORM_WORDS, true);
+}
+
+/**
+ * @brief Stops the stream of a channel.
+ */
+void channel_stream_stop(pulse_channel_t *ch) {
+    // An aborted channel can still trigger its chain (RP2040-E13), so unchain data_chan first
+    param_feed_set_chain(ch->data_chan, ch->data_chan);
+    dma_channel_abort(ch->data_chan);
+    dma_channel_abort(ch->ctrl_chan);
+}
+
+/**
+ * @brief Sets up an additional channel on its state machine (left disabled, see main()).
+ *
+ * @param channel         Channel number, runs on channel_pio() and channel_sm().
+ * @param program_offset  Offset of the uniform pulsegen program on the PIO block of the channel.
+ * @param set             First [cooldown, offset, combined] set.
+ */
+void channel_init(pulse_channel_t *ch, uint channel, uint program_offset, uint pin, const uint32_t *set) {
+    PIO pio = channel_pio(channel);
+    uint sm = channel_sm(channel);
+    ch->pio = pio;
+    ch->sm = sm;
+    ch->channel = channel;
+    ch->program_offset = program_offset;
+    ch->pin = pin;
+    ch->pending = false;
+    memcpy(ch->set, set, sizeof(ch->set));
+    ch->set_addr = ch->set;
+    ch->data_chan = dma_claim_unused_channel(true);
+    ch->ctrl_chan = dma_claim_unused_channel(true);
+    init_pulsegen_pio(pio, sm, program_offset, &variant_uniform, pin);
+    channel_stream_start(ch);
+    stats_served[channel]--; // The first request is not a served trigger
+}
+
+/**
+ * @brief Switches in the staged set if the state machine waits for a trigger.
+ *
+ * The state machine is stopped, the stream restarted with the new set and the state machine
+ * re-armed like in rearm_if_idle(). Must be called with interrupts disabled.
+ *
+ * @return true if the staged set is active (or nothing was staged).
+ */
+bool channel_swap_if_idle(pulse_channel_t *ch) {
+    if (!ch->pending) {
+        return true;
+    }
+    uint wait_trigger_pc = ch->program_offset + pulsegen_offset_wait_trigger;
+    if (pio_sm_get_pc(ch->pio, ch->sm) != wait_trigger_pc) {
+        return false;
+    }
+    pio_sm_set_enabled(ch->pio, ch->sm, false); // Cannot leave `wait_trigger` while the set is swapped
+    if (pio_sm_get_pc(ch->pio, ch->sm) != wait_trigger_pc) {
+        pio_sm_set_enabled(ch->pio, ch->sm, true); // Triggered between both checks
+        return false;
+    }
+    channel_stream_stop(ch);
+    stats_count_requests(ch->channel); // Before they are cleared
+    pio_sm_clear_fifos(ch->pio, ch->sm);
+    memcpy(ch->set, ch->next_set, sizeof(ch->set));
+    ch->pending = false;
+    channel_stream_start(ch);
+    while (pio_sm_get_tx_fifo_level(ch->pio, ch->sm) < FEED_UNIFORM_WORDS) {
+        tight_loop_contents();
+    }
+    pio_sm_exec(ch->pio, ch->sm, pio_encode_jmp(ch->program_offset + pulsegen_offset_rearm));
+    pio_sm_set_enabled(ch->pio, ch->sm, true);
+    return true;
+}
+
+/**
+ * @brief Stages new parameters for an additional channel.
+ *
+ * They are used from the next trigger on if the state machine is idle, otherwise the
+ * channel_task() switches them in once the train in flight is finished.
+ */
+void channel_update(pulse_channel_t *ch, const pulse_params_t *params) {
+    uint32_t irq_status = save_and_disable_interrupts();
+    params_to_set(params, ch->next_set);
+    ch->pending = true;
+    channel_swap_if_idle(ch);
+    restore_interrupts(irq_status);
+}
+
+/**
+ * @brief Retries pending parameter switches, called from the idle branch of the main loop.
+ */
+void channel_task(pulse_channel_t *ch) {
+    if (ch->pending) {
+        uint32_t irq_status = save_and_disable_interrupts();
+        channel_swap_if_idle(ch);
+        restore_interrupts(irq_status);
+    }
+}
+
+/**
+ * @brief Counts the points the DMA handed to the state machine since the last call.
+ *
+ * A point is consumed once the data channel finished copying it. If the state machine
+ * overtook the refill, stale ring entries were delivered; this is counted in
+ * `sweep_underruns` and the refill continues behind the DMA.
+ */
+void sweep_update_consumed(const pulsegen_t *pg) {
+    uint32_t index = param_feed_ring_index(&pg->feed);
+    uint32_t words = sweep_ring_partial + ((index - sweep_ring_index) & (FEED_RING_WORDS - 1));
+    sweep_consumed += words / FEED_UNIFORM_WORDS;
+    sweep_ring_partial = words % FEED_UNIFORM_WORDS;
+    sweep_ring_index = index;
+    if ((int32_t)(sweep_consumed - sweep_written) > 0) {
+        sweep_underruns++;
+        sweep_written = sweep_consumed;
+    }
+}
+
+/**
+ * @brief Returns the offset in cycles of point `index` of a random sweep.
+ *
+ * The generator is counter based (a hash of seed and index, without state carried from point
+ * to point), so the host reconstructs the offset of every shot from the seed and its index
+ * (see random_sweep_offset() in delay_control.py): x = seed + (index + 1) * 0x9E3779B9 is
+ * mixed by the lowbias32 hash and scaled into the window by a 32x32 -> 64 bit multiply. The
+ * scaling is uniform up to a relative error of offset_count / 2^32.
+ */
+uint32_t random_offset(const random_params_t *random, uint32_t index) {
+    uint32_t x = random->seed + (index + 1) * 0x9E3779B9u;
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return random->offset_min + (uint32_t)(((uint64_t)x * random->offset_count) >> 32);
+}
+
+/**
+ * @brief Refills `feed_ring` with the next points of `sweep_table` (or of a random sweep).
+ *
+ * The DMA ring has to be a power of two in size while the sweep length is arbitrary, so
+ * the ring is refilled from the table instead of walking the table itself. Called from the
+ * core0 loop; a ring holds FEED_RING_SETS triggers worth of points.
+ */
+void sweep_task(pulsegen_t *pg) {
+    if (sweep_len == 0) {
+        return;
+    }
+    if (pg->feed.ring != NULL) {
+        sweep_update_consumed(pg);
+    }
+    // Never overwrite the entry the DMA delivers next
+    while (sweep_written - sweep_consumed < FEED_RING_SETS) {
+        uint32_t word = sweep_written * FEED_UNIFORM_WORDS;
+        feed_ring[word & (FEED_RING_WORDS - 1)] = sweep_cooldown;
+        if (sweep_random.offset_count) {
+            feed_ring[(word + 1) & (FEED_RING_WORDS - 1)] = random_offset(&sweep_random, sweep_written) - MIN_OFFSET;
+            feed_ring[(word + 2) & (FEED_RING_WORDS - 1)] = sweep_random.combined;
+        } else {
+            feed_ring[(word + 1) & (FEED_RING_WORDS - 1)] = sweep_table[sweep_source][0];
+            feed_ring[(word + 2) & (FEED_RING_WORDS - 1)] = sweep_table[sweep_source][1];
+            sweep_source = (sweep_source + 1 < sweep_len) ? sweep_source + 1 : 0;
+        }
+        sweep_written++;
+    }
+}
+
+/**
+ * @brief Stops a running sweep, requests are answered from the parameter slots again.
+ *
+ * Returns once the DMA finished copying a point, so `sweep_table` can be rewritten afterwards.
+ */
+void sweep_stop(pulsegen_t *pg) {
+    if (pg->feed.ring != NULL) {
+        param_feed_use_slots(&pg->feed);
+    }
+    sweep_len = 0;
+}
+
+/**
+ * @brief Starts walking the first `len` points of `sweep_table`, one point per trigger.
+ *
+ * An idle state machine is re-armed with point 0 right away, so the n-th trigger after the
+ * start (counting from 0) uses point n % len. A random sweep draws the offset of point n
+ * with random_offset() instead, without repeating after a table length.
+ *
+ * Sweeps walk uniform trains, so they are not available in schedule or burst mode. A
+ * specialized variant (single pulse or fixed train) is swapped for the uniform one. All
+ * points use `cooldown` (the points of `sweep_table` have none).
+ *
+ * @param random    Offset window of a random sweep (`len` is ignored), NULL to walk `sweep_table`.
+ * @return false if `len` is 0 or exceeds SWEEP_MAX_POINTS, or in schedule or burst mode.
+ */
+bool sweep_start(pulsegen_t *pg, uint32_t len, uint32_t cooldown, const random_params_t *random) {
+    if (random != NULL) {
+        len = 1;
+    }
+    if (len == 0 || len > SWEEP_MAX_POINTS || schedule_len > 0 || burst_len > 0) {
+        return false;
+    }
+    sweep_stop(pg); // Ring is rewritten
+    sweep_random = random ? *random : (random_params_t){ 0 };
+    sweep_source = 0;
+    sweep_written = 0;
+    sweep_consumed = 0;
+    sweep_ring_index = 0;
+    sweep_ring_partial = 0;
+    sweep_underruns = 0;
+    sweep_cooldown = cooldown;
+    sweep_len = len;
+    sweep_task(pg); // Fill the whole ring
+
+    uint32_t irq_status = save_and_disable_interrupts();
+    if (pg->variant != &variant_uniform) {
+        bool rearm = oneshot_pending(pg);
+        pg->prescaler = 1;
+        pulsegen_swap_program(pg, &variant_uniform);
+        // The slots get point 0 too, so they hold a uniform set once the sweep is stopped
+        param_feed_commit(&pg->feed, feed_ring, FEED_UNIFORM_WORDS);
+        param_feed_use_ring(&pg->feed, feed_ring, FEED_RING_SIZE_BITS);
+        if (rearm) {
+            pulsegen_deliver_shot(pg); // Point 0
+        }
+        pio_sm_set_enabled(pg->pio, pg->sm, true); // Requests point 0 (unless in one-shot mode)
+    } else {
+        param_feed_use_ring(&pg->feed, feed_ring, FEED_RING_SIZE_BITS);
+        rearm_if_idle(pg);
+    }
+    restore_interrupts(irq_status);
+    return true;
+}
+
+/**
+ * @brief Picks the pulsegen variant channel 0 runs for `params` in the current mode.
+ *
+ * Schedule and burst mode have their own variant. Otherwise single pulses and fixed trains
+ * get the specialized variants with lower minimums, unless channel 0 shares its program with
+ * additional channels (PIO0_SHARED) and has to stay on the uniform one.
+ */
+const pulsegen_variant_t *select_variant(const pulse_params_t *params) {
+    if (burst_len > 0) return &variant_burst;
+    if (schedule_len > 0) return &variant_schedule;
+    if (PIO0_SHARED) return &variant_uniform;
+    return (params->repeats == 0) ? &variant_single : &variant_train;
+}
+
+/**
+ * @brief Converts host parameters into PIO loop counts and pushes them to the state machine.
+ *
+ * A running sweep is stopped, the new parameters replace it. In schedule mode the trains use
+ * the offset of `params` and the pulses of `schedule_pulses` (length, spacing and repeats of
+ * `params` are kept for uniform trains). In burst mode the uniform train of `params` is fired
+ * at every offset of `burst_offsets` instead of the offset of `params`. The pulsegen variant
+ * is swapped if select_variant() picks a different one (mode or repeats changed) or the
+ * prescaler of its spacing loop changed.
+ *
+ * @param params    Parameter set checked for select_variant(params).
+ */
+void apply_params(pulsegen_t *pg, const pulse_params_t *params) {
+    sweep_stop(pg);
+    const pulsegen_variant_t *variant = select_variant(params);
+    uint32_t set[FEED_MAX_WORDS];
+    uint words;
+    if (variant == &variant_burst) {
+        words = burst_to_set(params, burst_offsets, burst_len, set);
+    } else if (variant == &variant_schedule) {
+        set[0] = params->cooldown;
+        set[1] = params->offset - MIN_OFFSET;
+        memcpy(&set[2], schedule_pulses, schedule_len * sizeof(uint32_t));
+        set[schedule_len + 2] = 0; // Terminator
+        words = schedule_len + 3;
+    } else if (variant == &variant_single) {
+        params_to_single_set(params, set);
+        words = FEED_SINGLE_WORDS;
+    } else if (variant == &variant_train) {
+        params_to_train_set(params, set);
+        words = FEED_TRAIN_WORDS;
+    } else if (pg->variant == &variant_uniform) {
+        update_delay(pg, params->cooldown, params->offset - MIN_OFFSET, params->length - MIN_LENGTH,
+                     params->spacing - MIN_SPACING, params->repeats);
+        return;
+    } else {
+        params_to_set(params, set);
+        words = FEED_UNIFORM_WORDS;
+    }
+    uint32_t prescaler = effective_prescaler(params, variant);
+    if (pg->variant != variant || pg->prescaler != prescaler) {
+        pg->prescaler = prescaler; // Patched while the program is reloaded
+        pulsegen_set_variant(pg, variant, set, words);
+    } else {
+        pulsegen_update(pg, set, words);
+    }
+}
+
+bool ext_clock = false; // clk_sys runs from the target clock at EXT_CLOCK_PIN (see set_external_clock())
+volatile uint32_t ext_clock_losses = 0; // Switches back to the internal clock because the target clock stopped, reported by core1
+volatile bool ext_clock_lost = false; // Set by the resus interrupt, handled by clock_task()
+uint32_t internal_clock_khz = 0; // Internal clock before the external clock mode, restored if the target clock stops
+
+/**
+ * @brief Reads a parameter or a read-only status value by its key.
+ *
+ * Status keys:
+ * - 'i': sweep table index of the last point handed to the state machine (the point armed
+ *        for the next trigger while the state machine waits), the point index of a random
+ *        sweep (see random_offset())
+ * - 'n': number of sweep points handed to the state machine since the sweep was started
+ *
+ * The sweep counters are kept current by sweep_task() on core0, so this can run on core1.
+ * - 'p': pulses per train in schedule mode (0 for uniform trains)
+ * - 'b': trains per trigger in burst mode (0 for a single train)
+ * - 'u': spacing step in cycles (prescaler in effect, 1 unless fixed trains or bursts run with a prescaler)
+ * - 'f': system clock in Hz, the cycle time of all parameters is 1 / f
+ * - 't': trigger edges since boot (qualified edges while a skip count or width filter is set)
+ * - 'v': triggers served by the channel since boot (one train or burst each)
+ * - 'd': triggers the channel dropped since boot (t - v: edges during a train, its cooldown,
+ *        while the trigger was still high, or during a program swap)
+ * - 'w': sweep refills that came too late since the sweep was started
+ * - 'k', 'q': skip count and width filter of the trigger qualification (see FRAME_OP_QUALIFIER)
+ * - 'a': sequence number of the last arm in one-shot mode (0 before the first, see oneshot_arm())
+ * - 'e': sequence number of the last shot that fired ('a' while no shot is armed)
+ * - 'x': 1 while the system runs from the target clock (see set_external_clock())
+ * - 'y': switches back to the internal clock since boot because the target clock stopped
+ *   (each one is notified with CLOCK_LOST, see clock_report())
+ * - 'z': bit widths of the combined word, repeats | length << 8 | spacing << 16 (PULSEGEN_*_BITS)
+ * - 'g': 1 for the RAM-resident build (picoPulsegen_ram, copy_to_ram), 0 when running from flash
+ *
+ * 'v' and 'd' are also available on the other channels. The counters wrap at 2^32.
+ *
+ * @return false for an unknown key.
+ */
+bool get_value(pulse_params_t *params, char key, uint32_t *value) {
+    uint32_t *param = param_by_key(params, key);
+    if (param != NULL) {
+        *value = *param;
+        return true;
+    }
+    switch (key) {
+        case 'i': {
+            uint32_t consumed = sweep_consumed;
+            uint32_t len = sweep_len;
+            if (sweep_random.offset_count) {
+                *value = consumed ? consumed - 1 : 0; // Random points do not repeat
+                return true;
+            }
+            *value = (len && consumed) ? (consumed - 1) % len : 0;
+            return true;
+        }
+        case 'n': *value = sweep_consumed; return true;
+        case 'p': *value = schedule_len; return true;
+        case 'b': *value = burst_len; return true;
+        case 'u': *value = sweep_len ? 1 : effective_prescaler(params, select_variant(params)); return true;
+        case 'f': *value = clock_get_hz(clk_sys); return true;
+        case 't': *value = stats_triggers; return true;
+        case 'v': *value = stats_served[0]; return true;
+        case 'd': *value = stats_triggers - stats_served[0]; return true;
+        case 'w': *value = sweep_underruns; return true;
+        case 'k': *value = qualifier_params.skip; return true;
+        case 'q': *value = qualifier_params.width; return true;
+        case 'a': *value = oneshot_seq; return true;
+        case 'e': *value = oneshot_fired_seq; return true;
+        case 'x': *value = ext_clock; return true;
+        case 'y': *value = ext_clock_losses; return true;
+#if PICO_COPY_TO_RAM
+        case 'g': *value = 1; return true;
+#else
+        case 'g': *value = 0; return true;
+#endif
+        case 'z': *value = PULSEGEN_REPEATS_BITS | (PULSEGEN_LENGTH_BITS << 8) | (PULSEGEN_SPACING_BITS << 16); return true;
+        default: return false;
+    }
+}
+
+/**
+ * @brief Returns the variant the parameters of a channel are built for (see select_variant()).
+ */
+const pulsegen_variant_t *channel_variant(uint channel, const pulse_params_t *params) {
+    return (channel == 0) ? select_variant(params) : &variant_uniform;
+}
+
+/**
+ * @brief Checks a parameter set for a channel (see check_params() and check_burst()).
+ */
+char check_channel_params(uint channel, const pulse_params_t *params) {
+    char invalid_key = check_params(params, channel_variant(channel, params));
+    if (!invalid_key && channel == 0 && burst_len > 0) {
+        invalid_key = check_burst(params, burst_offsets, burst_len); // Trains must still fit
+    }
+    return invalid_key;
+}
+
+/**
+ * @brief Applies checked parameters to a channel (see apply_params() and channel_update()).
+ *
+ * @param channel_params  Parameters of all channels.
+ * @param channels        Additional channels (channel 1 is channels[0]).
+ */
+void apply_channel_params(pulsegen_t *pg, pulse_channel_t *channels, uint channel, const pulse_params_t *channel_params) {
+    if (channel == 0) {
+        apply_params(pg, &channel_params[0]);
+    } else {
+        channel_update(&channels[channel - 1], &channel_params[channel]);
+    }
+}
+
+pulse_params_t presets[PRESET_COUNT]; // Preset bank of channel 0, owned by core0
+uint32_t preset_stored = 0; // Bit mask of the stored presets
+uint32_t preset_pins = UINT32_MAX; // Select pin state the active preset was picked for (UINT32_MAX: none yet)
+bool preset_gpio = false; // Channel 0 follows the select pins (see preset_task()), written by core0
+
+/**
+ * @brief Stores the current parameters of channel 0 as preset `index` (called on core0).
+ *
+ * @return false if `index` is not below PRESET_COUNT.
+ */
+bool preset_store(uint32_t index) {
+    if (index >= PRESET_COUNT) {
+        return false;
+    }
+    presets[index] = channel_params[0];
+    preset_stored |= 1u << index;
+    return true;
+}
+
+/**
+ * @brief Makes preset `index` the parameters of channel 0 and applies them (called on core0).
+ *
+ * Like a SET the parameters are staged without stopping the state machine, presets that run
+ * a different pulsegen variant (e.g. single pulse and train) swap the program. The preset is
+ * checked again, the mode (schedule or burst) may have changed since it was stored.
+ *
+ * `channel_params` is written by core0 here: during control_call() core1 waits, with the select
+ * pins core1 rejects all changes of channel 0.
+ *
+ * @return false if the preset is not stored or not valid in the current mode.
+ */
+bool preset_select(pulsegen_t *pg, uint32_t index) {
+    if (index >= PRESET_COUNT || !(preset_stored & (1u << index)) || check_channel_params(0, &presets[index])) {
+        return false;
+    }
+    channel_params[0] = presets[index];
+    apply_params(pg, &channel_params[0]);
+    return true;
+}
+
+/**
+ * @brief Edge interrupt of the select pins (IO_IRQ_BANK0 on core0), it only wakes the core0 loop,
+ *        preset_task() reads the pins.
+ */
+void preset_pins_irq_handler(uint gpio, uint32_t events) {
+    (void)gpio;
+    (void)events;
+}
+
+/**
+ * @brief Lets the select pins pick the preset of channel 0, or returns it to the host.
+ *
+ * The pins are pulled down, so unconnected pins select preset 0. While they are used a pin
+ * change raises an interrupt on core0, the loop never polls them.
+ */
+void preset_set_gpio(bool enabled) {
+    for (uint i = 0; i < PRESET_SELECT_PINS; i++) {
+        gpio_init(PRESET_SELECT_PIN + i);
+        gpio_pull_down(PRESET_SELECT_PIN + i);
+        gpio_set_irq_enabled_with_callback(PRESET_SELECT_PIN + i, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL,
+                                           enabled, preset_pins_irq_handler);
+    }
+    preset_pins = UINT32_MAX; // Apply the preset of the current pin state
+    preset_gpio = enabled;
+}
+
+/**
+ * @brief Switches channel 0 to the preset of the select pins when they change, called from the
+ *        core0 loop.
+ *
+ * The new set is committed to the feed and used from the next request on (the next
+ * recover_parameters of the state machine, or right away if it is idle), without any USB
+ * traffic. A pin state that selects a missing or invalid preset keeps the active one.
+ */
+void preset_task(pulsegen_t *pg) {
+    if (!preset_gpio) {
+        return;
+    }
+    uint32_t pins = (gpio_get_all() >> PRESET_SELECT_PIN) & (PRESET_COUNT - 1);
+    if (pins != preset_pins) {
+        preset_pins = pins;
+        preset_select(pg, pins);
+    }
+}
+
+/**
+ * @brief Reads a value of a channel, status keys (see get_value()) are only available on channel 0
+ *        (except for the counters 'v' and 'd').
+ *
+ * @return false for an unknown key.
+ */
+bool get_channel_value(pulse_params_t *channel_params, uint channel, char key, uint32_t *value) {
+    if (channel == 0) {
+        return get_value(&channel_params[0], key, value);
+    }
+    if (key == 'v' || key == 'd') {
+        uint32_t served = stats_served[channel];
+        *value = (key == 'v') ? served : stats_triggers - served;
+        return true;
+    }
+    uint32_t *param = param_by_key(&channel_params[channel], key);
+    if (param == NULL) {
+        return false;
+    }
+    *value = *param;
+    return true;
+}
+
+/**
+ * @brief Switches the system clock, and with it the cycle time of all state machines, to `khz`.
+ *
+ * Parameters stay in cycles, so the host has to send them again to keep their times in ns.
+ * The state machines keep running while clk_sys is switched over to clk_ref and back (a
+ * trigger during the switch is served with the wrong timing). Above SYS_CLOCK_VREG_KHZ the
+ * core voltage is raised before switching, otherwise it is set back to the default after.
+ * The baud rate of the command UART is set again for the new clk_peri.
+ *
+ * @return false if `khz` is out of range or cannot be generated by the PLL.
+ */
+bool set_system_clock(uint32_t khz) {
+    uint vco, postdiv1, postdiv2;
+    if (khz < SYS_CLOCK_MIN_KHZ || khz > SYS_CLOCK_MAX_KHZ || !check_sys_clock_khz(khz, &vco, &postdiv1, &postdiv2)) {
+        return false;
+    }
+    if (khz > SYS_CLOCK_VREG_KHZ) {
+        vreg_set_voltage(VREG_VOLTAGE_1_20);
+        sleep_us(SYS_CLOCK_VREG_SETTLE_US);
+    }
+    #if defined(ENABLE_COMMAND_UART)
+        uart_tx_wait_blocking(COMMAND_UART); // The last response is sent with the old baud divisor
+    #endif
+    set_sys_clock_khz(khz, true); // Also moves clk_peri back to clk_sys
+    ext_clock = false;
+    if (khz <= SYS_CLOCK_VREG_KHZ) {
+        vreg_set_voltage(VREG_VOLTAGE_DEFAULT);
+    }
+    #if defined(ENABLE_COMMAND_UART)
+        uart_set_baudrate(COMMAND_UART, COMMAND_UART_BAUD); // clk_peri follows the system clock
+    #endif
+    return true;
+}
+
+/**
+ * @brief Resus callback on core0: the target clock stopped.
+ *
+ * The resus hardware has already moved clk_sys to clk_ref when this runs. The clock is not
+ * reconfigured here, core0 may be inside set_system_clock() or set_external_clock() of a
+ * control request; clock_task() handles the loss from the core0 loop.
+ */
+void external_clock_lost(void) {
+    ext_clock_lost = true;
+    __sev();
+}
+
+/**
+ * @brief Switches back to the internal clock after the target clock stopped (called from the
+ *        core0 loop).
+ *
+ * All parameters are counts of target cycles, which would now run on the internal clock. So
+ * the qualifiers are stopped first: no channel sees a trigger until the host sets a clock
+ * again (`C`/`X`, see clock_release()). core1 notifies the host (see clock_report()).
+ */
+void clock_task(void) {
+    if (!ext_clock_lost) {
+        return;
+    }
+    ext_clock_lost = false;
+    if (!ext_clock) { // The host switched to the internal clock meanwhile
+        return;
+    }
+    trigger_hold = true;
+    qualifier_disable(&qualifier);
+    set_system_clock(internal_clock_khz);
+    __dmb(); // The clock is visible to core1 before the count changes
+    ext_clock_losses++;
+    __sev(); // Wakes the command parser (command_wait_event())
+}
+
+/**
+ * @brief Releases the triggers held since a clock loss, after the host set a clock (core0).
+ */
+void clock_release(void) {
+    if (trigger_hold) {
+        trigger_hold = false;
+        qualifier_enable(&qualifier);
+    }
+}
+
+/**
+ * @brief Clocks the system, and with it all state machines, directly from the target clock at
+ *        EXT_CLOCK_PIN (GPIN0).
+ *
+ * One cycle of the state machines is then one cycle of the target: offsets, lengths and
+ * spacings are counted in target clock cycles and stay phase-locked to it, there is no drift
+ * between the two clocks over long offsets. The PLL cannot multiply a GPIN input, so the
+ * resolution is the target's clock period. `khz` is checked against the frequency counter
+ * before switching (a missing clock would stop clk_sys for good). If the target clock stops
+ * later, the resus interrupt switches back to the internal clock (see external_clock_lost()).
+ *
+ * @return false if `khz` is out of range or does not match the measured input frequency.
+ */
+bool set_external_clock(uint32_t khz) {
+    if (khz < EXT_CLOCK_MIN_KHZ || khz > EXT_CLOCK_MAX_KHZ) {
+        return false;
+    }
+    gpio_set_function(EXT_CLOCK_PIN, GPIO_FUNC_GPCK); // Input to the frequency counter
+    uint32_t measured = frequency_count_khz(CLOCKS_FC0_SRC_VALUE_CLKSRC_GPIN0);
+    uint32_t tolerance = khz / 100 + 1; // Counter resolution plus 1% crystal tolerance
+    if (measured + tolerance < khz || measured > khz + tolerance) {
+        return false;
+    }
+    if (!ext_clock) {
+        internal_clock_khz = clock_get_hz(clk_sys) / 1000;
+    }
+    static bool resus_enabled = false;
+    if (!resus_enabled) {
+        clocks_enable_resus(external_clock_lost);
+        resus_enabled = true;
+    }
+
+    #if defined(ENABLE_COMMAND_UART)
+        uart_tx_wait_blocking(COMMAND_UART);
+    #endif
+    clock_configure_gpin(clk_sys, EXT_CLOCK_PIN, khz * 1000, khz * 1000);
+    clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB,
+                    EXT_CLOCK_PERI_KHZ * 1000, EXT_CLOCK_PERI_KHZ * 1000);
+    vreg_set_voltage(VREG_VOLTAGE_DEFAULT);
+    #if defined(ENABLE_COMMAND_UART)
+        uart_set_baudrate(COMMAND_UART, COMMAND_UART_BAUD);
+    #endif
+    ext_clock = true;
+    return true;
+}
+
+/**
+ * @brief Trigger-to-pulse latency statistics of a self-test (in cycles).
+ */
+typedef struct {
+    uint32_t shots;                    // Shots with a rising pulse edge in the capture window
+    uint32_t misses;                   // Shots without (output already high at the trigger, or no edge in the window)
+    uint32_t min;
+    uint32_t max;
+    uint32_t mean_milli;               // Mean latency in 1/1000 cycles
+    uint32_t hist_base;                // Latency of hist[0]
+    uint32_t hist[SELFTEST_HIST_BINS]; // Shots per latency, clamped to the first and last bin
+} selftest_result_t;
+
+selftest_result_t selftest_result; // Written by selftest_run() on core0, read by core1 after control_call()
+uint32_t selftest_window[SELFTEST_WINDOW_WORDS]; // Samples of the current shot (see selftest_capture.pio)
+
+/**
+ * @brief Finds the first rising edge in a capture window.
+ *
+ * @return Latency of the edge from the trigger edge in cycles, -1 if the output was already
+ *         high at the trigger or did not rise within the window.
+ */
+int selftest_first_edge(const uint32_t *window) {
+    if (window[0] & 1u) {
+        return -1;
+    }
+    for (uint w = 0; w < SELFTEST_WINDOW_WORDS; w++) {
+        if (window[w]) {
+            return (int)(w * 32 + __builtin_ctz(window[w])) + SELFTEST_CAPTURE_LATENCY;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Measures the trigger-to-pulse latency of a channel output over `shots` triggers.
+ *
+ * The capture program is loaded into the free instruction memory of pio0 for the duration of
+ * the test, its SM samples the output pin once per cycle from every trigger edge on and a DMA
+ * channel collects SELFTEST_WINDOW_WORDS words per shot. The trigger comes from TRIGGER_PIN as
+ * usual (e.g. the test trigger wired from TEST_PIN). Blocks core0 until all shots were taken or
+ * no trigger arrived for SELFTEST_SHOT_TIMEOUT_US, so it is not run during a sweep (no refills).
+ * With a skip count the capture would start on skipped edges, so it is not run either.
+ * The histogram is centered on the latency of the first shot.
+ *
+ * @return false if the capture SM, its program (e.g. next to burst mode) or a DMA channel is
+ *         not available.
+ */
+bool selftest_run(uint channel, uint32_t shots, selftest_result_t *result) {
+    PIO pio = pio0;
+    const uint channel_pins[] = CHANNEL_PINS;
+    if (PIO0_SHARED || sweep_len > 0 || qualifier.params.skip > 0 || !pio_can_add_program(pio, &selftest_capture_program)) {
+        return false;
+    }
+    int chan = dma_claim_unused_channel(false);
+    if (chan < 0) {
+        return false;
+    }
+    uint offset = pio_add_program(pio, &selftest_capture_program);
+    pio_sm_config c = selftest_capture_program_get_default_config(offset);
+    sm_config_set_in_pins(&c, channel_pins[channel]);
+    sm_config_set_in_shift(&c, true, true, 32); // Shift right, autopush after 32 samples
+    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_RX);
+    sm_config_set_clkdiv(&c, 1.0f);
+    pio_sm_init(pio, SELFTEST_SM, offset, &c);
+
+    dma_channel_config cfg = dma_channel_get_default_config(chan);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&cfg, false);
+    channel_config_set_write_increment(&cfg, true);
+    channel_config_set_dreq(&cfg, pio_get_dreq(pio, SELFTEST_SM, false));
+
+    memset(result, 0, sizeof(*result));
+    result->min = UINT32_MAX;
+    uint64_t sum = 0;
+    for (uint32_t shot = 0; shot < shots; shot++) {
+        pio_sm_set_enabled(pio, SELFTEST_SM, false);
+        pio_sm_clear_fifos(pio, SELFTEST_SM);
+        pio_sm_restart(pio, SELFTEST_SM); // Also clears the ISR shift count
+        pio_sm_exec(pio, SELFTEST_SM, pio_encode_jmp(offset));
+        dma_channel_configure(chan, &cfg, selftest_window, &pio->rxf[SELFTEST_SM], SELFTEST_WINDOW_WORDS, true);
+        pio_sm_set_enabled(pio, SELFTEST_SM, true);
+
+        absolute_time_t deadline = make_timeout_time_us(SELFTEST_SHOT_TIMEOUT_US);
+        while (dma_channel_is_busy(chan) && !time_reached(deadline)) {
+            tight_loop_contents();
+        }
+        if (dma_channel_is_busy(chan)) { // No trigger
+            dma_channel_abort(chan);
+            break;
+        }
+
+        int latency = selftest_first_edge(selftest_window);
+        if (latency < 0) {
+            result->misses++;
+            continue;
+        }
+        if (result->shots == 0) {
+            result->hist_base = (latency > SELFTEST_HIST_BINS / 2) ? (uint32_t)latency - SELFTEST_HIST_BINS / 2 : 0;
+        }
+        uint32_t bin = ((uint32_t)latency > result->hist_base) ? (uint32_t)latency - result->hist_base : 0;
+        result->hist[MIN(bin, SELFTEST_HIST_BINS - 1)]++;
+        result->min = MIN(result->min, (uint32_t)latency);
+        result->max = MAX(result->max, (uint32_t)latency);
+        sum += (uint32_t)latency;
+        result->shots++;
+    }
+
+    pio_sm_set_enabled(pio, SELFTEST_SM, false);
+    pio_remove_program(pio, &selftest_capture_program, offset);
+    dma_channel_unclaim(chan);
+    if (result->shots == 0) {
+        result->min = 0;
+    }
+    else {
+        result->mean_milli = (uint32_t)(sum * 1000 / result->shots);
+    }
+    return true;
+}
+
+/**
+ * @brief Continues a CRC-16/CCITT-FALSE (poly 0x1021) over a buffer.
+ *
+ * @param crc   CRC of the bytes before, 0xFFFF at the start.
+ */
+uint16_t crc16_ccitt_update(uint16_t crc, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+/**
+ * @brief Calculates the CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) of a buffer.
+ *
+ * This is the same CRC as Python's `binascii.crc_hqx(data, 0xFFFF)`.
+ */
+uint16_t crc16_ccitt(const uint8_t *data, size_t len) {
+    return crc16_ccitt_update(0xFFFF, data, len);
+}
+
+/**
+ * @brief Configuration saved to flash with `W` and restored at power-up (see config_load()).
+ *
+ * Parameters are counted in cycles, so the clock they were set for is saved with them.
+ */
+typedef struct {
+    uint32_t magic;                       // CONFIG_MAGIC
+    uint32_t size;                        // sizeof(config_record_t), records of another layout are ignored
+    uint32_t seq;                         // Save counter, the valid record with the highest one is loaded
+    uint32_t clock_khz;                   // System clock
+    uint32_t clock_external;              // 1: clock_khz is the target clock (see set_external_clock())
+    pulse_params_t channels[NUM_CHANNELS];
+    pulse_params_t presets[PRESET_COUNT];
+    uint32_t preset_stored;               // Bit mask of the stored presets
+    uint32_t preset_gpio;                 // 1: channel 0 follows the select pins
+    qualifier_params_t qualifier;
+    uint32_t crc;                         // crc16_ccitt() of all fields before
+} config_record_t;
+
+_Static_assert(sizeof(config_record_t) <= CONFIG_SLOT_SIZE, "config_record_t exceeds CONFIG_SLOT_SIZE");
+
+volatile bool flash_parked = false; // core1 waits in RAM while core0 writes the flash (see flash_park())
+
+/**
+ * @brief Returns the record slot `slot` of the ring, read through XIP.
+ */
+const config_record_t *config_slot(uint32_t slot) {
+    return (const config_record_t *)(uintptr_t)(XIP_BASE + CONFIG_FLASH_OFFSET + slot * CONFIG_SLOT_SIZE);
+}
+
+/**
+ * @brief Checks magic, layout and CRC of a record slot.
+ */
+bool config_valid(const config_record_t *record) {
+    return record->magic == CONFIG_MAGIC && record->size == sizeof(config_record_t) &&
+           record->crc == crc16_ccitt((const uint8_t *)record, offsetof(config_record_t, crc));
+}
+
+/**
+ * @brief Checks that a record slot is still erased (can be programmed without an erase).
+ */
+bool config_slot_erased(uint32_t slot) {
+    const uint32_t *words = (const uint32_t *)config_slot(slot);
+    for (uint i = 0; i < CONFIG_SLOT_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != UINT32_MAX) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Finds the last saved record of the ring.
+ *
+ * @return Slot of the valid record with the highest save counter, -1 if there is none.
+ */
+int config_latest(void) {
+    int latest = -1;
+    for (uint32_t slot = 0; slot < CONFIG_SLOTS; slot++) {
+        const config_record_t *record = config_slot(slot);
+        if (config_valid(record) && (latest < 0 || (int32_t)(record->seq - config_slot(latest)->seq) > 0)) {
+            latest = (int)slot;
+        }
+    }
+    return latest;
+}
+
+/**
+ * @brief Restores the saved configuration, called by main() before the state machines are loaded.
+ *
+ * Runs before core1 (and with it USB) is started, so the saved parameters are staged for the
+ * first trigger within milliseconds of power-up. Channels whose saved parameters are no longer
+ * valid (e.g. after a firmware change of the limits) keep their defaults.
+ *
+ * @return false if no valid record was found.
+ */
+bool config_load(void) {
+    int latest = config_latest();
+    if (latest < 0) {
+        return false;
+    }
+    const config_record_t *record = config_slot((uint32_t)latest);
+    if (record->clock_external) {
+        set_external_clock(record->clock_khz); // Stays on the internal clock if the target is not running
+    }
+    else if (record->clock_khz != clock_get_hz(clk_sys) / 1000) {
+        set_system_clock(record->clock_khz);
+    }
+    for (uint i = 0; i < NUM_CHANNELS; i++) {
+        if (!check_channel_params(i, &record->channels[i])) {
+            channel_params[i] = record->channels[i];
+        }
+    }
+    memcpy(presets, record->presets, sizeof(presets)); // Checked again by preset_select()
+    preset_stored = record->preset_stored & ((1u << PRESET_COUNT) - 1);
+    if (!check_qualifier(&record->qualifier)) {
+        qualifier_params = record->qualifier;
+    }
+    if (record->preset_gpio) {
+        preset_set_gpio(true);
+    }
+    return true;
+}
+
+/**
+ * @brief Waits in RAM until core0 finished writing the flash (called on core1 with its
+ *        interrupts disabled, see config_save()).
+ *
+ * The flash is not readable through XIP while it is erased or programmed, so core1 must not
+ * fetch a single instruction from it. The SDK's multicore lockout is not used, it takes over
+ * the SIO FIFO of control_call().
+ */
+void __not_in_flash_func(flash_park)(void) {
+    flash_parked = true;
+    while (flash_parked) {
+        tight_loop_contents();
+    }
+}
+
+/**
+ * @brief Saves the current configuration to the next slot of the flash ring (called on core0).
+ *
+ * The slots are written one after the other, so every sector is erased only once per
+ * CONFIG_SLOTS_PER_SECTOR saves and all sectors of the ring wear evenly. The record is
+ * complete before its first byte is programmed and the previous one is never erased by the
+ * same save, a save interrupted by a power loss leaves the previous configuration in place
+ * (and a partly written slot is skipped by the next save).
+ *
+ * core1 waits in flash_park() during the write, core0 with its interrupts disabled: the state
+ * machines and their DMA keep firing with the current parameters, which do not depend on the
+ * flash, but triggers in the up to ~50 ms of a sector erase are served without the counting
+ * interrupt. Not run during a sweep (no refills).
+ *
+ * @return false during a sweep or if the record read back differs.
+ */
+bool config_save(void) {
+    static union {
+        config_record_t record;
+        uint8_t bytes[CONFIG_SLOT_SIZE];
+    } data;
+    while (!flash_parked) {
+        tight_loop_contents();
+    }
+
+    bool written = false;
+    if (sweep_len == 0) {
+        int latest = config_latest();
+        uint32_t slot = (latest < 0) ? 0 : (uint32_t)(latest + 1) % CONFIG_SLOTS;
+        if (slot % CONFIG_SLOTS_PER_SECTOR != 0 && !config_slot_erased(slot)) {
+            slot = (slot / CONFIG_SLOTS_PER_SECTOR + 1) % CONFIG_FLASH_SECTORS * CONFIG_SLOTS_PER_SECTOR;
+        }
+
+        memset(data.bytes, 0xFF, sizeof(data.bytes));
+        data.record.magic = CONFIG_MAGIC;
+        data.record.size = sizeof(config_record_t);
+        data.record.seq = (latest < 0) ? 1 : config_slot((uint32_t)latest)->seq + 1;
+        data.record.clock_khz = clock_get_hz(clk_sys) / 1000;
+        data.record.clock_external = ext_clock;
+        memcpy(data.record.channels, channel_params, sizeof(data.record.channels));
+        memcpy(data.record.presets, presets, sizeof(data.record.presets));
+        data.record.preset_stored = preset_stored;
+        data.record.preset_gpio = preset_gpio;
+        data.record.qualifier = qualifier_params;
+        data.record.crc = crc16_ccitt(data.bytes, offsetof(config_record_t, crc));
+
+        uint32_t offset = CONFIG_FLASH_OFFSET + slot * CONFIG_SLOT_SIZE;
+        uint32_t irq_status = save_and_disable_interrupts();
+        if (slot % CONFIG_SLOTS_PER_SECTOR == 0) {
+            flash_range_erase(offset, FLASH_SECTOR_SIZE);
+        }
+        flash_range_program(offset, data.bytes, CONFIG_SLOT_SIZE);
+        restore_interrupts(irq_status);
+        written = memcmp(config_slot(slot), &data.record, sizeof(config_record_t)) == 0;
+    }
+
+    __dmb(); // Flash is readable again before core1 returns to it
+    flash_parked = false;
+    return written;
+}
+
+/**
+ * @brief Durations of one kind of reconfiguration in cycles (FRAME_OP_LATENCY).
+ *
+ * Measured with the SysTick of the measuring core, which counts down at clk_sys and wraps
+ * after 2^24 cycles (56 ms at 300 MHz), far longer than any measured step.
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t last;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+} latency_stats_t;
+
+latency_stats_t apply_latency; // CONTROL_APPLY on core0 (update_delay() or a program swap), written while core1 waits in control_call()
+latency_stats_t frame_latency; // SET frames on core1, from the complete frame to the sent response
+
+/**
+ * @brief Starts the SysTick of the calling core as a free-running cycle counter.
+ */
+void latency_init(void) {
+    systick_hw->rvr = 0x00FFFFFF;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+}
+
+void latency_reset(latency_stats_t *stats) {
+    *stats = (latency_stats_t){ .min = UINT32_MAX };
+}
+
+/**
+ * @brief Adds the cycles since `start` (a reading of `systick_hw->cvr`).
+ */
+void latency_record(latency_stats_t *stats, uint32_t start) {
+    uint32_t cycles = (start - systick_hw->cvr) & 0x00FFFFFF; // Counts down
+    stats->count++;
+    stats->last = cycles;
+    stats->sum += cycles;
+    if (cycles < stats->min) {
+        stats->min = cycles;
+    }
+    if (cycles > stats->max) {
+        stats->max = cycles;
+    }
+}
+
+/**
+ * @brief Operations core1 hands over to core0 (everything that touches PIO or DMA).
+ */
+typedef enum {
+    CONTROL_APPLY = 0,       // apply_channel_params() for the channel
+    CONTROL_SWEEP_START = 1, // sweep_start() with arg points of `sweep_table`
+    CONTROL_SWEEP_STOP = 2,  // sweep_stop(), `sweep_table` may be rewritten afterwards
+    CONTROL_CLOCK = 3,       // set_system_clock() with arg kHz
+    CONTROL_SELFTEST = 4,    // selftest_run() of the channel with arg shots, into `selftest_result`
+    CONTROL_STIMULUS = 5,    // stimulus_start() with `stimulus_params`
+    CONTROL_QUALIFIER = 6,   // qualifier_apply() with `qualifier_params`
+    CONTROL_ARM = 7,         // oneshot_arm() with arg 1 (arm) or 0 (leave one-shot mode)
+    CONTROL_SWEEP_RANDOM = 8, // sweep_start() of a random sweep with `random_params`
+    CONTROL_PRESET_STORE = 9, // preset_store() of preset arg
+    CONTROL_PRESET_SELECT = 10, // preset_select() of preset arg (rejected while the select pins are used)
+    CONTROL_PRESET_GPIO = 11, // preset_set_gpio() with arg 1 (select pins) or 0
+    CONTROL_SAVE = 12,       // config_save(), core1 waits in flash_park() meanwhile
+    CONTROL_EXT_CLOCK = 13   // set_external_clock() with arg kHz
+} ControlOp;
+
+typedef struct {
+    ControlOp op;
+    uint channel;
+    uint32_t arg;
+} control_request_t;
+
+/**
+ * @brief Runs a control operation on core0 and waits for its result (called on core1).
+ *
+ * The request is passed by address through the SIO FIFO. core1 blocks until core0 answered,
+ * so `channel_params`, `schedule_pulses`, `burst_offsets`, `stimulus_params`,
+ * `qualifier_params` and `random_params` are never written while core0 reads them.
+ *
+ * @return Result of the operation (false if sweep_start() rejected the sweep,
+ *         set_system_clock() or set_external_clock() the clock, selftest_run() could not
+ *         run, there is no stimulus generator, qualifier_apply() rejected the qualification,
+ *         oneshot_arm() is not available or config_save() failed).
+ */
+bool control_call(ControlOp op, uint channel, uint32_t arg) {
+    static control_request_t request;
+    request.op = op;
+    request.channel = channel;
+    request.arg = arg;
+    __dmb(); // Request and parameters are visible before core0 picks up the address
+    if (op == CONTROL_SAVE) { // No flash access on core1 (USB interrupts included) until core0 is done
+        uint32_t irq_status = save_and_disable_interrupts();
+        multicore_fifo_push_blocking((uint32_t)(uintptr_t)&request);
+        flash_park();
+        bool result = multicore_fifo_pop_blocking() != 0;
+        restore_interrupts(irq_status);
+        return result;
+    }
+    multicore_fifo_push_blocking((uint32_t)(uintptr_t)&request);
+    return multicore_fifo_pop_blocking() != 0;
+}
+
+/**
+ * @brief Executes a pending control request of core1, if there is one (called on core0).
+ */
+void control_task(pulsegen_t *pg, pulse_channel_t *channels) {
+    if (!multicore_fifo_rvalid()) {
+        return;
+    }
+    const control_request_t *request = (const control_request_t *)(uintptr_t)multicore_fifo_pop_blocking();
+    bool result = true;
+    switch (request->op) {
+        case CONTROL_APPLY: {
+            uint32_t start = systick_hw->cvr;
+            apply_channel_params(pg, channels, request->channel, channel_params);
+            latency_record(&apply_latency, start);
+            break;
+        }
+        case CONTROL_SWEEP_START: result = sweep_start(pg, request->arg, channel_params[0].cooldown, NULL); break;
+        case CONTROL_SWEEP_RANDOM: result = sweep_start(pg, 0, channel_params[0].cooldown, &random_params); break;
+        case CONTROL_PRESET_STORE: result = preset_store(request->arg); break;
+        case CONTROL_PRESET_SELECT: result = !preset_gpio && preset_select(pg, request->arg); break;
+        case CONTROL_PRESET_GPIO: preset_set_gpio(request->arg != 0); break;
+        case CONTROL_SWEEP_STOP: sweep_stop(pg); break;
+        case CONTROL_CLOCK:
+        case CONTROL_EXT_CLOCK:
+            result = (request->op == CONTROL_CLOCK) ? set_system_clock(request->arg) : set_external_clock(request->arg);
+            if (result) {
+                clock_release(); // The host knows the clock the parameters are counted in
+            }
+            break;
+        case CONTROL_SELFTEST:
+            // Channel 0 fires a single shot per arm in one-shot mode
+            result = !(request->channel == 0 && pg->feed.one_shot) &&
+                     selftest_run(request->channel, request->arg, &selftest_result);
+            break;
+        case CONTROL_STIMULUS:
+            result = stimulus.pio != NULL;
+            if (result) {
+                stimulus_start(&stimulus, &stimulus_params);
+            }
+            break;
+        case CONTROL_QUALIFIER: result = qualifier_apply(&qualifier, &qualifier_params); break;
+        case CONTROL_ARM: result = oneshot_arm(pg, request->arg != 0); break;
+        case CONTROL_SAVE: result = config_save(); break;
+    }
+    __dmb(); // Results (e.g. sweep state) are visible before core1 continues
+    multicore_fifo_push_blocking(result);
+}
+
+/**
+ * @brief Sleeps until the next event unless a task of the core0 loop has to poll (called on core0).
+ *
+ * Every task of the loop is started by an event: requests of core1 (multicore_fifo_push_blocking()
+ * sends one), the request DMA of each channel 0 trigger (DMA_IRQ_0, the sweep refill), the
+ * qualifier and channel requests (PIO0/1_IRQ_0), the preset select pins (IO_IRQ_BANK0) and the
+ * clock monitor (resus, see external_clock_lost()).
+ * An interrupt between the checks and __wfe() sets the event register on its return, so it is
+ * not lost. Only a staged set of an additional channel waits for its state machine to go idle
+ * without an interrupt, the loop keeps polling while one is pending.
+ */
+void core0_wait_event(const pulse_channel_t *channels) {
+    for (uint i = 1; i < NUM_CHANNELS; i++) {
+        if (channels[i - 1].pending) {
+            return;
+        }
+    }
+    __wfe();
+}
+
+/**
+ * @brief Reads a little-endian uint32 from a byte buffer.
+ */
+uint32_t get_le32(const uint8_t *buf) {
+    return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+/**
+ * @brief Reads a little-endian uint16 from a byte buffer.
+ */
+uint16_t get_le16(const uint8_t *buf) {
+    return (uint16_t)(buf[0] | (buf[1] << 8));
+}
+
+
+/**
+ * @brief Reads `len` bytes from stdio, giving up once `deadline` is reached.
+ *
+ * Returns as soon as the last byte arrived, the deadline only guards against
+ * truncated frames.
+ *
+ * @return true if all bytes were received.
+ */
+bool read_bytes_until(uint8_t *buf, size_t len, absolute_time_t deadline) {
+    for (size_t i = 0; i < len; i++) {
+        int64_t remaining_us = absolute_time_diff_us(get_absolute_time(), deadline);
+        if (remaining_us <= 0) {
+            return false;
+        }
+        int read_char = getchar_timeout_us((uint32_t)remaining_us);
+        if (read_char == PICO_ERROR_TIMEOUT) {
+            return false;
+        }
+        buf[i] = (uint8_t)read_char;
+    }
+    return true;
+}
+
+int frame_tag = -1; // Tag of the frame handle_frame() is answering, -1 for an untagged frame (core1)
+
+/**
+ * @brief Sends a binary response frame.
+ *
+ * Layout: FRAME_SYNC, LEN (= 2 + data_len), opcode, status, data, CRC-16 (little-endian,
+ * calculated over LEN up to the last data byte). The response to a tagged frame starts with
+ * FRAME_SYNC_TAGGED and the tag instead, the CRC then starts at the tag. Bytes are written
+ * raw, so the stdio CR/LF translation cannot corrupt the frame.
+ */
+void send_frame(uint8_t opcode, uint8_t status, const uint8_t *data, uint8_t data_len) {
+    uint8_t frame[FRAME_MAX_LEN + 5];
+    if (data_len > FRAME_MAX_LEN - 2) {
+        data_len = FRAME_MAX_LEN - 2;
+    }
+
+    size_t start = 1; // First byte covered by the CRC
+    frame[0] = FRAME_SYNC;
+    if (frame_tag >= 0) {
+        frame[0] = FRAME_SYNC_TAGGED;
+        frame[start++] = (uint8_t)frame_tag;
+    }
+    uint8_t *body = &frame[start];
+    body[0] = data_len + 2;
+    body[1] = opcode;
+    body[2] = status;
+    if (data_len > 0) {
+        memcpy(&body[3], data, data_len);
+    }
+    uint16_t crc = crc16_ccitt(&frame[1], start + data_len + 2);
+    body[3 + data_len] = crc & 0xFF;
+    body[4 + data_len] = crc >> 8;
+
+    for (size_t i = 0; i < start + data_len + 5; i++) {
+        putchar_raw(frame[i]);
+    }
+    stdio_flush();
+}
+
+bool oneshot_frames = false; // FIRED notifications as frames (the last arm was a frame), written by core1
+uint32_t oneshot_reported_seq = 0; // Sequence number of the last FIRED notification, core1 only
+
+/**
+ * @brief Whether a shot fired that oneshot_report() has not sent yet (called on core1).
+ */
+bool oneshot_report_pending(void) {
+    return oneshot_fired_seq != oneshot_reported_seq;
+}
+
+/**
+ * @brief Notifies the host of a shot that fired since the last call (called on core1).
+ *
+ * stats_dma_irq_handler() records the shot on core0 as soon as its train is finished, core1
+ * sends the notification between two commands, so it never ends up inside a response.
+ * ASCII: `FIRED <seq> <us> <triggers>`, after a binary arm a FRAME_OP_FIRED frame with status
+ * OK and the sequence number, the time_us_32() timestamp of the end of the train and the
+ * trigger count (`G t`) at that moment as data (u32 LE each). The next shot is armed by core1
+ * itself, so the fields cannot change while they are read.
+ */
+void oneshot_report(void) {
+    uint32_t seq = oneshot_fired_seq;
+    if (seq == oneshot_reported_seq) {
+        return;
+    }
+    oneshot_reported_seq = seq;
+    __dmb(); // Timestamp and trigger count were written before the sequence number
+    uint32_t fields[3] = { seq, oneshot_fired_us, oneshot_fired_triggers };
+    if (oneshot_frames) {
+        uint8_t data[sizeof(fields)];
+        for (size_t i = 0; i < sizeof(data); i++) {
+            data[i] = fields[i / 4] >> (8 * (i % 4));
+        }
+        send_frame(FRAME_OP_FIRED, FRAME_STATUS_OK, data, sizeof(data));
+    }
+    else {
+        printf("FIRED %u %u %u\n", fields[0], fields[1], fields[2]);
+    }
+}
+
+bool clock_frames = false; // CLOCK_LOST notifications as frames (the last `X` was a frame), written by core1
+uint32_t clock_reported_losses = 0; // ext_clock_losses of the last CLOCK_LOST notification, core1 only
+
+/**
+ * @brief Whether the target clock was lost since the last clock_report() (called on core1).
+ */
+bool clock_report_pending(void) {
+    return ext_clock_losses != clock_reported_losses;
+}
+
+/**
+ * @brief Notifies the host that the pico fell back to the internal clock (called on core1).
+ *
+ * Sent between two commands like the FIRED notification. ASCII: `CLOCK_LOST <losses> <hz>`,
+ * after a binary `X` a FRAME_OP_CLOCK_LOST frame with status OK and the loss count (`G y`) and
+ * the clock now running in Hz as data (u32 LE each). The triggers stay held until the host
+ * sets a clock (see clock_task()).
+ */
+void clock_report(void) {
+    uint32_t losses = ext_clock_losses;
+    if (losses == clock_reported_losses) {
+        return;
+    }
+    clock_reported_losses = losses;
+    __dmb(); // The clock was switched before the count changed
+    uint32_t fields[2] = { losses, clock_get_hz(clk_sys) };
+    if (clock_frames) {
+        uint8_t data[sizeof(fields)];
+        for (size_t i = 0; i < sizeof(data); i++) {
+            data[i] = fields[i / 4] >> (8 * (i % 4));
+        }
+        send_frame(FRAME_OP_CLOCK_LOST, FRAME_STATUS_OK, data, sizeof(data));
+    }
+    else {
+        printf("CLOCK_LOST %u %u\n", fields[0], fields[1]);
+    }
+}
+
+/**
+ * @brief Fills `sweep_table` from a FRAME_OP_SWEEP_GRID payload.
+ *
+ * Payload: offset start/step (u32), offset count (u16), length start/step/count (u16),
+ * repeats start/step/count (u16), all LE and in cycles. Spacing is taken from `params`.
+ * Points are ordered with the offset changing fastest, then length, then repeats.
+ *
+ * @param status    Set to the frame status on error.
+ * @param invalid_key Set to the key of a rejected parameter (FRAME_STATUS_RANGE).
+ * @return Number of generated points, 0 on error.
+ */
+uint32_t sweep_generate_grid(const pulse_params_t *params, const uint8_t *payload, uint8_t *status, uint8_t *invalid_key) {
+    uint32_t offset_start = get_le32(&payload[0]);
+    uint32_t offset_step = get_le32(&payload[4]);
+    uint32_t offset_count = get_le16(&payload[8]);
+    uint32_t length_start = get_le16(&payload[10]);
+    uint32_t length_step = get_le16(&payload[12]);
+    uint32_t length_count = get_le16(&payload[14]);
+    uint32_t repeats_start = get_le16(&payload[16]);
+    uint32_t repeats_step = get_le16(&payload[18]);
+    uint32_t repeats_count = get_le16(&payload[20]);
+
+    uint64_t points = (uint64_t)offset_count * length_count * repeats_count; // Three u16 counts overflow 32 bits
+    if (points == 0 || points > SWEEP_MAX_POINTS) {
+        *status = FRAME_STATUS_SWEEP;
+        return 0;
+    }
+    uint32_t len = (uint32_t)points;
+
+    control_call(CONTROL_SWEEP_STOP, 0, 0); // Table is rewritten
+    pulse_params_t point = *params;
+    for (uint32_t i = 0; i < len; i++) {
+        uint32_t o = i % offset_count;
+        uint32_t l = (i / offset_count) % length_count;
+        uint32_t r = i / (offset_count * length_count);
+        point.offset = offset_start + o * offset_step;
+        point.length = length_start + l * length_step;
+        point.repeats = repeats_start + r * repeats_step;
+        *invalid_key = (uint8_t)check_params(&point, &variant_uniform);
+        if (*invalid_key) {
+            *status = FRAME_STATUS_RANGE;
+            return 0;
+        }
+        params_to_pair(&point, sweep_table[i]);
+    }
+    return len;
+}
+
+/**
+ * @brief Replaces `schedule_pulses` from a FRAME_OP_SCHEDULE payload.
+ *
+ * Each pulse is given as length (u16 LE) and spacing to the next pulse (u32 LE) in cycles,
+ * with the same minimums as uniform trains. The schedule is only changed if all pulses are
+ * valid; it is applied by the next apply_params().
+ *
+ * @param count     Number of pulses, 0 switches back to uniform trains.
+ * @return          0 on success, otherwise the key of the first invalid parameter.
+ */
+uint8_t set_schedule(const pulse_params_t *params, const uint8_t *payload, uint32_t count) {
+    uint32_t pulses[SCHEDULE_MAX_PULSES];
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *pulse_buf = &payload[i * SCHEDULE_PULSE_LEN];
+        pulse_params_t pulse = *params;
+        pulse.length = get_le16(&pulse_buf[0]);
+        pulse.spacing = get_le32(&pulse_buf[2]);
+        uint8_t invalid_key = (uint8_t)check_params(&pulse, &variant_schedule);
+        if (invalid_key) {
+            return invalid_key;
+        }
+        // Repeats field is the marker of pulsegen_schedule.pio (nonzero: pulse)
+        pulses[i] = pack_combined_parameters(1, pulse.spacing - MIN_SPACING, pulse.length - MIN_LENGTH);
+    }
+    memcpy(schedule_pulses, pulses, sizeof(pulses));
+    schedule_len = count;
+    burst_len = 0; // Modes are exclusive
+    return 0;
+}
+
+/**
+ * @brief Replaces `burst_offsets` from a FRAME_OP_BURST payload (absolute offsets, u32 LE cycles).
+ *
+ * The offsets are only changed if they are valid for the current trains (see check_burst());
+ * they are applied by the next apply_params().
+ *
+ * @param count     Number of offsets, 0 switches back to a single train.
+ * @return          0 on success, otherwise the key of the rejected parameter.
+ */
+uint8_t set_burst(const pulse_params_t *params, const uint8_t *payload, uint32_t count) {
+    uint32_t offsets[BURST_MAX_OFFSETS];
+    for (uint32_t i = 0; i < count; i++) {
+        offsets[i] = get_le32(&payload[i * 4]);
+    }
+    // The trains of burst mode have the minimums of uniform trains
+    uint8_t invalid_key = (count > 0) ? (uint8_t)check_params(params, &variant_burst) : 0;
+    if (!invalid_key) {
+        invalid_key = (uint8_t)check_burst(params, offsets, count);
+    }
+    if (invalid_key) {
+        return invalid_key;
+    }
+    memcpy(burst_offsets, offsets, sizeof(offsets));
+    burst_len = count;
+    if (count > 0) {
+        schedule_len = 0; // Modes are exclusive
+    }
+    return 0;
+}
+
+/**
+ * @brief Saves the configuration to flash (FRAME_OP_SAVE or ASCII `W`).
+ *
+ * @return FRAME_STATUS_OK, FRAME_STATUS_MODE during a sweep, FRAME_STATUS_FLASH if the
+ *         record read back differs.
+ */
+uint8_t save_command(void) {
+    if (control_call(CONTROL_SAVE, 0, 0)) {
+        return FRAME_STATUS_OK;
+    }
+    return sweep_len ? FRAME_STATUS_MODE : FRAME_STATUS_FLASH;
+}
+
+/**
+ * @brief Executes one `key value` assignment of a preset command (FRAME_OP_PRESET or ASCII `P`).
+ *
+ * - 's': store the current parameters of channel 0 as preset `value`
+ * - 'p': switch channel 0 to preset `value` (not while the select pins are used)
+ * - 'g': 1 lets the select pins pick the preset, 0 returns channel 0 to the host
+ *
+ * @return FRAME_STATUS_OK, FRAME_STATUS_PARAM for an unknown key, FRAME_STATUS_RANGE for a
+ *         preset out of range, not stored or invalid in the current mode, FRAME_STATUS_MODE.
+ */
+uint8_t preset_command(char key, uint32_t value) {
+    switch (key) {
+        case 's':
+            return control_call(CONTROL_PRESET_STORE, 0, value) ? FRAME_STATUS_OK : FRAME_STATUS_RANGE;
+        case 'p':
+            if (preset_gpio) {
+                return FRAME_STATUS_MODE;
+            }
+            return control_call(CONTROL_PRESET_SELECT, 0, value) ? FRAME_STATUS_OK : FRAME_STATUS_RANGE;
+        case 'g':
+            if (value > 1) {
+                return FRAME_STATUS_RANGE;
+            }
+            control_call(CONTROL_PRESET_GPIO, 0, value);
+            return FRAME_STATUS_OK;
+        default:
+            return FRAME_STATUS_PARAM;
+    }
+}
 
 /**
- * @brief DMA interrupt handler to automatically restart a DMA transfer.
+ * @brief Receives and executes one binary command frame (FRAME_SYNC already consumed).
  *
- * This function is called when the DMA channel finishes its transfer (i.e., the transfer
- * count is exhausted). It clears the interrupt flag for the associated DMA channel and
- * restarts the transfer. This creates the effect of an "infinite" DMA loop when used
- * with a fixed source and destination.
+ * Request layout: FRAME_SYNC, LEN, opcode, payload (LEN - 1 bytes), CRC-16 (little-endian,
+ * calculated over LEN up to the last payload byte). A tagged frame starts with
+ * FRAME_SYNC_TAGGED and a tag byte before LEN, the CRC then starts at the tag and the
+ * response carries the same tag (see send_frame()). Tags let the host keep several frames in
+ * flight and match the responses even if one of them is rejected before its opcode is known.
  *
- * Note: This function assumes that `dma_chan` is a global variable specifying the DMA channel used.
+ * - FRAME_OP_GET payload: list of parameter/status keys (see get_value()), response data:
+ *   one uint32 (LE) per key.
+ * - FRAME_OP_SET payload: list of (key, uint32 LE value) pairs. All values are checked
+ *   before anything is committed, a rejected parameter is returned as single data byte
+ *   with FRAME_STATUS_RANGE.
+ * - FRAME_OP_GET_CHANNEL/FRAME_OP_SET_CHANNEL: channel byte followed by the payload of
+ *   FRAME_OP_GET/FRAME_OP_SET for that channel (FRAME_OP_GET/FRAME_OP_SET address channel 0).
+ * - FRAME_OP_SWEEP_LOAD payload: start index (u16 LE) followed by points of SWEEP_POINT_LEN
+ *   bytes, written into `sweep_table` (stops a running sweep).
+ * - FRAME_OP_SWEEP_GRID payload: see sweep_generate_grid(), response data: number of points (u32).
+ * - FRAME_OP_SWEEP_START payload: number of points (u32 LE), see sweep_start().
+ * - FRAME_OP_SWEEP_STOP: no payload, back to the parameters of the last SET.
+ * - FRAME_OP_PRESET payload: list of (key, uint32 LE value) pairs executed in order, see
+ *   preset_command(). On error the key is returned as data byte.
+ * - FRAME_OP_SWEEP_RANDOM payload: seed, smallest and largest offset (u32 LE each, cycles).
+ *   Starts a sweep with a random offset per trigger (see random_offset()), the other
+ *   parameters are those of channel 0.
+ * - FRAME_OP_SCHEDULE payload: pulses of SCHEDULE_PULSE_LEN bytes (max SCHEDULE_MAX_PULSES),
+ *   see set_schedule(). An empty payload switches back to uniform trains.
+ * - FRAME_OP_BURST payload: absolute train offsets (u32 LE, max BURST_MAX_OFFSETS), see
+ *   set_burst(). An empty payload switches back to a single train.
+ * - FRAME_OP_CLOCK payload: system clock in kHz (u32 LE), response data: clock in Hz (u32).
+ * - FRAME_OP_CLOCK_EXT payload: frequency of the target clock at EXT_CLOCK_PIN in kHz (u32 LE),
+ *   see set_external_clock(). Response data: clock in Hz (u32). If the target clock stops
+ *   later, a FRAME_OP_CLOCK_LOST frame is sent on its own (see clock_report()).
+ * - FRAME_OP_SELFTEST payload: channel byte and number of shots (u32 LE), see selftest_run().
+ *   Response data: the fields of selftest_result_t (u32 LE each).
+ * - FRAME_OP_STIMULUS payload: repeats (u32 LE, 0 = continuous) followed by pulses of
+ *   STIMULUS_PULSE_LEN bytes (max STIMULUS_PATTERN_MAX_PULSES), see stimulus_start(). An empty
+ *   pattern turns the stimulus generator off.
+ * - FRAME_OP_QUALIFIER payload: skip count and width filter (u32 LE each, see
+ *   qualifier_params_t), optionally followed by pattern, its length and sample period (u32 LE
+ *   each, see check_qualifier()). A skip count or width filter is not available in burst mode
+ *   (their programs do not fit next to pulsegen_burst.pio, see burst_fits()).
+ * - FRAME_OP_ARM payload: 1 byte, 1 arms a single shot of channel 0, 0 leaves one-shot mode (see
+ *   oneshot_arm()). Response data: sequence number of the armed shot (u32). Once it fired, the
+ *   device sends a FRAME_OP_FIRED frame on its own (see oneshot_report()).
+ * - FRAME_OP_SAVE: no payload, saves the configuration to flash (see config_save()).
+ * - FRAME_OP_LATENCY payload: 1 byte, 1 resets the statistics after reading them. Response data:
+ *   count, last, min, max and mean (u32 LE each, cycles) of `apply_latency`, then the same of
+ *   `frame_latency` (see latency_stats_t). core0 only writes `apply_latency` while core1 waits
+ *   for it, so both are read and reset here.
+ *
+ * The frame is acknowledged as soon as its last byte arrived (no inter-character timeouts).
+ * Runs on core1, changes are applied by core0 (see control_call()) before the response is sent.
  */
-void dma_irq_handler() {
-    // Clear interrupt request
-    dma_hw->ints0 = 1u << dma_chan;
-    dma_channel_start(dma_chan);
+void handle_frame(pulse_params_t *channel_params, bool tagged) {
+    pulse_params_t *params = &channel_params[0]; // Sweep, schedule and burst mode run on channel 0
+    uint8_t frame[FRAME_MAX_LEN + 3];
+    absolute_time_t deadline = make_timeout_time_us(FRAME_TIMEOUT_US);
+
+    uint8_t tag = 0;
+    if (tagged) {
+        if (!read_bytes_until(&tag, 1, deadline)) {
+            send_frame(0, FRAME_STATUS_TIMEOUT, NULL, 0);
+            return;
+        }
+        frame_tag = tag;
+    }
+
+    // Length byte, then opcode + payload + CRC
+    if (!read_bytes_until(&frame[0], 1, deadline)) {
+        send_frame(0, FRAME_STATUS_TIMEOUT, NULL, 0);
+        return;
+    }
+    uint8_t len = frame[0];
+    if (len < 1 || len > FRAME_MAX_LEN) {
+        send_frame(0, FRAME_STATUS_LENGTH, NULL, 0);
+        return;
+    }
+    if (!read_bytes_until(&frame[1], len + 2, deadline)) {
+        send_frame(0, FRAME_STATUS_TIMEOUT, NULL, 0);
+        return;
+    }
+    uint16_t crc = frame[1 + len] | (frame[2 + len] << 8);
+    if (crc != crc16_ccitt_update(tagged ? crc16_ccitt(&tag, 1) : 0xFFFF, frame, len + 1)) {
+        send_frame(0, FRAME_STATUS_CRC, NULL, 0);
+        return;
+    }
+
+    uint32_t frame_start = systick_hw->cvr;
+    uint8_t opcode = frame[1];
+    const uint8_t *payload = &frame[2];
+    uint8_t payload_len = len - 1;
+
+    uint channel = 0;
+    if (opcode == FRAME_OP_GET_CHANNEL || opcode == FRAME_OP_SET_CHANNEL) {
+        if (payload_len < 1 || payload[0] >= NUM_CHANNELS) {
+            send_frame(opcode, FRAME_STATUS_CHANNEL, NULL, 0);
+            return;
+        }
+        channel = payload[0];
+        payload++;
+        payload_len--;
+    }
+
+    if (opcode == FRAME_OP_GET || opcode == FRAME_OP_GET_CHANNEL) {
+        uint8_t data[FRAME_MAX_LEN - 2];
+        uint8_t data_len = 0;
+        for (uint8_t i = 0; i < payload_len; i++) {
+            uint32_t value;
+            if (!get_channel_value(channel_params, channel, (char)payload[i], &value) || (size_t)data_len + 4 > sizeof(data)) {
+                send_frame(opcode, FRAME_STATUS_PARAM, &payload[i], 1);
+                return;
+            }
+            data[data_len++] = value & 0xFF;
+            data[data_len++] = (value >> 8) & 0xFF;
+            data[data_len++] = (value >> 16) & 0xFF;
+            data[data_len++] = value >> 24;
+        }
+        send_frame(opcode, FRAME_STATUS_OK, data, data_len);
+    }
+    else if (opcode == FRAME_OP_SET || opcode == FRAME_OP_SET_CHANNEL) {
+        if (payload_len % 5 != 0) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        if (channel == 0 && preset_gpio) { // The select pins own channel 0
+            send_frame(opcode, FRAME_STATUS_MODE, NULL, 0);
+            return;
+        }
+        pulse_params_t new_params = channel_params[channel]; // Copy current values
+        for (uint8_t i = 0; i < payload_len; i += 5) {
+            uint32_t *param = param_by_key(&new_params, (char)payload[i]);
+            if (param == NULL) {
+                send_frame(opcode, FRAME_STATUS_PARAM, &payload[i], 1);
+                return;
+            }
+            *param = get_le32(&payload[i + 1]);
+        }
+        uint8_t invalid_key = (uint8_t)check_channel_params(channel, &new_params);
+        if (invalid_key) {
+            send_frame(opcode, FRAME_STATUS_RANGE, &invalid_key, 1);
+            return;
+        }
+
+        quantize_spacing(&new_params, channel_variant(channel, &new_params));
+        channel_params[channel] = new_params;
+        control_call(CONTROL_APPLY, channel, 0);
+        send_frame(opcode, FRAME_STATUS_OK, NULL, 0);
+        latency_record(&frame_latency, frame_start);
+    }
+    else if (opcode == FRAME_OP_SWEEP_LOAD) {
+        if (payload_len < 2 || (payload_len - 2) % SWEEP_POINT_LEN != 0) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        uint32_t start = get_le16(&payload[0]);
+        uint32_t count = (payload_len - 2) / SWEEP_POINT_LEN;
+        if (start + count > SWEEP_MAX_POINTS) {
+            send_frame(opcode, FRAME_STATUS_SWEEP, NULL, 0);
+            return;
+        }
+        control_call(CONTROL_SWEEP_STOP, 0, 0); // Table is rewritten
+        for (uint32_t i = 0; i < count; i++) {
+            const uint8_t *point_buf = &payload[2 + i * SWEEP_POINT_LEN];
+            pulse_params_t point = {
+                .offset = get_le32(&point_buf[0]),
+                .spacing = get_le32(&point_buf[4]),
+                .length = get_le16(&point_buf[8]),
+                .repeats = get_le16(&point_buf[10]),
+                .prescaler = 1 // Sweep points are not prescaled
+            };
+            uint8_t invalid_key = (uint8_t)check_params(&point, &variant_uniform);
+            if (invalid_key) {
+                send_frame(opcode, FRAME_STATUS_RANGE, &invalid_key, 1);
+                return;
+            }
+            params_to_pair(&point, sweep_table[start + i]);
+        }
+        send_frame(opcode, FRAME_STATUS_OK, NULL, 0);
+    }
+    else if (opcode == FRAME_OP_SWEEP_GRID) {
+        if (payload_len != 22) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        uint8_t status = FRAME_STATUS_OK;
+        uint8_t invalid_key = 0;
+        uint32_t points = sweep_generate_grid(params, payload, &status, &invalid_key);
+        if (points == 0) {
+            send_frame(opcode, status, &invalid_key, status == FRAME_STATUS_RANGE ? 1 : 0);
+            return;
+        }
+        uint8_t data[4] = { points & 0xFF, (points >> 8) & 0xFF, (points >> 16) & 0xFF, points >> 24 };
+        send_frame(opcode, FRAME_STATUS_OK, data, sizeof(data));
+    }
+    else if (opcode == FRAME_OP_SWEEP_START) {
+        if (payload_len != 4) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        if (schedule_len > 0 || burst_len > 0) {
+            send_frame(opcode, FRAME_STATUS_MODE, NULL, 0);
+            return;
+        }
+        if (!control_call(CONTROL_SWEEP_START, 0, get_le32(payload))) {
+            send_frame(opcode, FRAME_STATUS_SWEEP, NULL, 0);
+            return;
+        }
+        send_frame(opcode, FRAME_STATUS_OK, NULL, 0);
+    }
+    else if (opcode == FRAME_OP_SWEEP_RANDOM) {
+        if (payload_len != 12) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        if (schedule_len > 0 || burst_len > 0) {
+            send_frame(opcode, FRAME_STATUS_MODE, NULL, 0);
+            return;
+        }
+        uint32_t offset_min = get_le32(&payload[4]);
+        uint32_t offset_max = get_le32(&payload[8]);
+        pulse_params_t point = *params;
+        point.prescaler = 1; // Sweep points are not prescaled
+        point.offset = offset_max;
+        uint8_t invalid_key = (uint8_t)check_params(&point, &variant_uniform);
+        point.offset = offset_min;
+        if (!invalid_key) {
+            invalid_key = (uint8_t)check_params(&point, &variant_uniform);
+        }
+        if (!invalid_key && offset_max < offset_min) {
+            invalid_key = 'o';
+        }
+        if (invalid_key) {
+            send_frame(opcode, FRAME_STATUS_RANGE, &invalid_key, 1);
+            return;
+        }
+        uint32_t pair[2];
+        params_to_pair(&point, pair);
+        random_params = (random_params_t){
+            .seed = get_le32(&payload[0]),
+            .offset_min = offset_min,
+            .offset_count = offset_max - offset_min + 1,
+            .combined = pair[1]
+        };
+        if (!control_call(CONTROL_SWEEP_RANDOM, 0, 0)) {
+            send_frame(opcode, FRAME_STATUS_MODE, NULL, 0);
+            return;
+        }
+        send_frame(opcode, FRAME_STATUS_OK, NULL, 0);
+    }
+    else if (opcode == FRAME_OP_PRESET) {
+        if (payload_len % 5 != 0) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        for (uint8_t i = 0; i < payload_len; i += 5) {
+            uint8_t status = preset_command((char)payload[i], get_le32(&payload[i + 1]));
+            if (status != FRAME_STATUS_OK) {
+                send_frame(opcode, status, &payload[i], 1);
+                return;
+            }
+        }
+        send_frame(opcode, FRAME_STATUS_OK, NULL, 0);
+    }
+    else if (opcode == FRAME_OP_SWEEP_STOP) {
+        control_call(CONTROL_APPLY, 0, 0); // Stops the sweep, re-arm with the parameters of the last SET
+        send_frame(opcode, FRAME_STATUS_OK, NULL, 0);
+    }
+    else if (opcode == FRAME_OP_SCHEDULE) {
+        if (PIO0_SHARED && payload_len > 0) {
+            send_frame(opcode, FRAME_STATUS_MODE, NULL, 0);
+            return;
+        }
+        if (payload_len % SCHEDULE_PULSE_LEN != 0 || payload_len / SCHEDULE_PULSE_LEN > SCHEDULE_MAX_PULSES) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        uint8_t invalid_key = set_schedule(params, payload, payload_len / SCHEDULE_PULSE_LEN);
+        if (invalid_key) {
+            send_frame(opcode, FRAME_STATUS_RANGE, &invalid_key, 1);
+            return;
+        }
+        control_call(CONTROL_APPLY, 0, 0);
+        send_frame(opcode, FRAME_STATUS_OK, NULL, 0);
+    }
+    else if (opcode == FRAME_OP_BURST) {
+        if ((PIO0_SHARED || !burst_fits(&qualifier_params)) && payload_len > 0) {
+            send_frame(opcode, FRAME_STATUS_MODE, NULL, 0);
+            return;
+        }
+        if (payload_len % 4 != 0 || payload_len / 4 > BURST_MAX_OFFSETS) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        uint8_t invalid_key = set_burst(params, payload, payload_len / 4);
+        if (invalid_key) {
+            send_frame(opcode, FRAME_STATUS_RANGE, &invalid_key, 1);
+            return;
+        }
+        control_call(CONTROL_APPLY, 0, 0);
+        send_frame(opcode, FRAME_STATUS_OK, NULL, 0);
+    }
+    else if (opcode == FRAME_OP_CLOCK || opcode == FRAME_OP_CLOCK_EXT) {
+        if (payload_len != 4) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        ControlOp op = (opcode == FRAME_OP_CLOCK_EXT) ? CONTROL_EXT_CLOCK : CONTROL_CLOCK;
+        if (op == CONTROL_EXT_CLOCK) {
+            clock_frames = true;
+        }
+        if (!control_call(op, 0, get_le32(payload))) {
+            uint8_t invalid_key = 'f';
+            send_frame(opcode, FRAME_STATUS_RANGE, &invalid_key, 1);
+            return;
+        }
+        uint32_t hz = clock_get_hz(clk_sys);
+        uint8_t data[4] = { hz & 0xFF, (hz >> 8) & 0xFF, (hz >> 16) & 0xFF, hz >> 24 };
+        send_frame(opcode, FRAME_STATUS_OK, data, sizeof(data));
+    }
+    else if (opcode == FRAME_OP_SELFTEST) {
+        if (payload_len != 5) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        if (payload[0] >= NUM_CHANNELS) {
+            send_frame(opcode, FRAME_STATUS_CHANNEL, NULL, 0);
+            return;
+        }
+        uint32_t shots = get_le32(&payload[1]);
+        if (shots < 1 || shots > SELFTEST_MAX_SHOTS) {
+            uint8_t invalid_key = 'n';
+            send_frame(opcode, FRAME_STATUS_RANGE, &invalid_key, 1);
+            return;
+        }
+        if (!control_call(CONTROL_SELFTEST, payload[0], shots)) {
+            send_frame(opcode, FRAME_STATUS_MODE, NULL, 0);
+            return;
+        }
+        const uint32_t *fields = (const uint32_t *)&selftest_result;
+        uint8_t data[sizeof(selftest_result_t)];
+        for (size_t i = 0; i < sizeof(selftest_result_t) / sizeof(uint32_t); i++) {
+            data[4 * i] = fields[i] & 0xFF;
+            data[4 * i + 1] = (fields[i] >> 8) & 0xFF;
+            data[4 * i + 2] = (fields[i] >> 16) & 0xFF;
+            data[4 * i + 3] = fields[i] >> 24;
+        }
+        send_frame(opcode, FRAME_STATUS_OK, data, sizeof(data));
+    }
+    else if (opcode == FRAME_OP_STIMULUS) {
+        if (payload_len < 4 || (payload_len - 4) % STIMULUS_PULSE_LEN != 0 ||
+            (payload_len - 4) / STIMULUS_PULSE_LEN > STIMULUS_PATTERN_MAX_PULSES) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        stimulus_params_t new_stimulus;
+        new_stimulus.repeats = get_le32(payload);
+        new_stimulus.len = (payload_len - 4) / STIMULUS_PULSE_LEN;
+        for (uint i = 0; i < new_stimulus.len; i++) {
+            new_stimulus.pulses[i][0] = get_le32(&payload[4 + i * STIMULUS_PULSE_LEN]);
+            new_stimulus.pulses[i][1] = get_le32(&payload[8 + i * STIMULUS_PULSE_LEN]);
+        }
+        if (!check_stimulus(&new_stimulus)) {
+            uint8_t invalid_key = 'h';
+            send_frame(opcode, FRAME_STATUS_RANGE, &invalid_key, 1);
+            return;
+        }
+        stimulus_params_t previous = stimulus_params;
+        stimulus_params = new_stimulus;
+        if (!control_call(CONTROL_STIMULUS, 0, 0)) {
+            stimulus_params = previous;
+            send_frame(opcode, FRAME_STATUS_MODE, NULL, 0);
+            return;
+        }
+        send_frame(opcode, FRAME_STATUS_OK, NULL, 0);
+    }
+    else if (opcode == FRAME_OP_ARM) {
+        if (payload_len != 1) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        if (!control_call(CONTROL_ARM, 0, payload[0])) {
+            send_frame(opcode, FRAME_STATUS_MODE, NULL, 0);
+            return;
+        }
+        oneshot_frames = true;
+        uint32_t seq = oneshot_seq;
+        uint8_t data[4] = { seq & 0xFF, (seq >> 8) & 0xFF, (seq >> 16) & 0xFF, seq >> 24 };
+        send_frame(opcode, FRAME_STATUS_OK, data, sizeof(data));
+    }
+    else if (opcode == FRAME_OP_SAVE) {
+        if (payload_len != 0) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        send_frame(opcode, save_command(), NULL, 0);
+    }
+    else if (opcode == FRAME_OP_LATENCY) {
+        if (payload_len != 1) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        uint8_t data[40];
+        const latency_stats_t *all[2] = { &apply_latency, &frame_latency };
+        for (uint i = 0; i < 2; i++) {
+            const latency_stats_t *stats = all[i];
+            uint32_t fields[5] = {
+                stats->count, stats->last, stats->count ? stats->min : 0, stats->max,
+                stats->count ? (uint32_t)(stats->sum / stats->count) : 0
+            };
+            for (uint j = 0; j < 20; j++) {
+                data[i * 20 + j] = fields[j / 4] >> (8 * (j % 4));
+            }
+        }
+        if (payload[0]) {
+            latency_reset(&apply_latency);
+            latency_reset(&frame_latency);
+        }
+        send_frame(opcode, FRAME_STATUS_OK, data, sizeof(data));
+    }
+    else if (opcode == FRAME_OP_QUALIFIER) {
+        if (payload_len != 8 && payload_len != 20) {
+            send_frame(opcode, FRAME_STATUS_LENGTH, NULL, 0);
+            return;
+        }
+        qualifier_params_t new_qualifier = { .skip = get_le32(payload), .width = get_le32(&payload[4]) };
+        if (payload_len == 20) {
+            new_qualifier.pattern = get_le32(&payload[8]);
+            new_qualifier.pattern_bits = get_le32(&payload[12]);
+            new_qualifier.pattern_period = get_le32(&payload[16]);
+        }
+        uint8_t invalid_key = (uint8_t)check_qualifier(&new_qualifier);
+        if (invalid_key) {
+            send_frame(opcode, FRAME_STATUS_RANGE, &invalid_key, 1);
+            return;
+        }
+        qualifier_params_t previous = qualifier_params;
+        qualifier_params = new_qualifier;
+        if (!control_call(CONTROL_QUALIFIER, 0, 0)) {
+            qualifier_params = previous;
+            send_frame(opcode, FRAME_STATUS_MODE, NULL, 0);
+            return;
+        }
+        send_frame(opcode, FRAME_STATUS_OK, NULL, 0);
+    }
+    else {
+        send_frame(opcode, FRAME_STATUS_OPCODE, NULL, 0);
+    }
 }
 
+uint32_t command_core_stack[COMMAND_CORE_STACK_SIZE / sizeof(uint32_t)];
 
 /**
- * @brief Sets up a DMA channel to continuously send a constant 32-bit value to a PIO TX FIFO.
- *
- * This function configures a DMA channel to repeatedly transfer a single 32-bit word
- * (pointed to by `fifo_value`) into the TX FIFO of the specified PIO state machine.
+ * @brief Reads a decimal ASCII value, terminated by a space or the end of the command (timeout).
  *
- * The transfer is throttled using the PIO TX FIFO DREQ signal. An interrupt handler is set
- * up to auto-restart the DMA when the transfer completes (simulating infinite transfer).
- *
- * @param pio         The PIO instance (e.g., pio0 or pio1).
- * @param sm          The state machine index (0–3) to send data to.
- * @param fifo_value  Pointer to a 32-bit value to be sent repeatedly to the PIO TX FIFO.
+ * @return false if a non-digit was received or the value does not fit into 11 digits.
  */
-void setup_dma(PIO pio, uint sm, const uint32_t *fifo_value) {
-    dma_chan = dma_claim_unused_channel(true);
-    dma_channel_config dma_cfg = dma_channel_get_default_config(dma_chan);
-    channel_config_set_transfer_data_size(&dma_cfg, DMA_SIZE_32);
-    channel_config_set_read_increment(&dma_cfg, false); // Always write the same word from buffer (first word)
-    channel_config_set_write_increment(&dma_cfg, false); // Do not increment target addr (always write to same PIO FIFO addr)
-    channel_config_set_dreq(&dma_cfg, pio_get_dreq(pio, sm, true));  // Throttle by PIO TX FIFO
-
-
-    // Configure to auto-restart DMA when it finishes (number of transfers reached)
-    dma_channel_set_irq0_enabled(dma_chan, true);
-    irq_set_exclusive_handler(DMA_IRQ_0, dma_irq_handler);
-    irq_set_enabled(DMA_IRQ_0, true);
-
-    dma_channel_configure(
-        dma_chan,
-        &dma_cfg,
-        &pio->txf[sm],         // dest: PIO FIFO
-        fifo_value,           // src: ring buffer
-        0xFFFFFFFF,           // number of transfers
-        false                 // don't start yet
-    );
-
-    dma_channel_start(dma_chan);
+bool read_ascii_value(uint32_t *value) {
+    char val_buf[12];
+    memset(val_buf, 0, sizeof(val_buf)); // Zeroize value buffer
+    for (size_t i = 0; i < sizeof(val_buf); i++) {
+        int read_char = getchar_timeout_us(900000);
+        if (read_char == PICO_ERROR_TIMEOUT || read_char == ' ') { // End of command or end of parameter value
+            *value = (uint32_t)strtoul(val_buf, NULL, 10); // Convert string buffer to number
+            return true;
+        }
+        if (!isdigit((char)read_char)) {
+            return false;
+        }
+        val_buf[i] = (char)read_char;
+    }
+    return false; // No separation char received (passed number does not fit into bounds)
 }
 
-
 /**
- * @brief Packs three separate parameters into a single 32-bit word.
- *
- * This function combines three values — `repeats`, `spacing`, and `length` —
- * into a single `uint32_t` by assigning specific bit fields:
- *
- * - `repeats`: 5 bits  (bits 0–4)
- * - `length`:  7 bits  (bits 5–11)
- * - `spacing`: 20 bits (bits 12–31)
+ * @brief Reads the `key value` pairs of an ASCII command until the end of the command (timeout).
  *
- * @param repeats   Number of repetitions (max 31).
- * @param spacing   Time or space between operations (max 1048576).
- * @param length    Length or size indicator (max 127).
- * @return          A 32-bit word encoding all three parameters.
+ * @return Number of pairs read, -1 on a malformed pair or more than ASCII_MAX_ASSIGNMENTS pairs.
  */
-uint32_t pack_combined_parameters(uint repeats, uint spacing, uint length) {
-    // Ensure inputs are within valid bit sizes
-    if (repeats > 0x1F) repeats = 0x1F;         // 5 bits max: 31
-    if (spacing > 0x1FFFFF) spacing = 0x1FFFFF; // 20 bits max: 1048575
-    if (length > 0x7F) length = 0x7F;           // 7 bits max: 127
+int read_ascii_assignments(char *keys, uint32_t *values) {
+    int count = 0;
+    while (1) {
+        // Get parameter key
+        int read_char = getchar_timeout_us(100000);
+        if (read_char == PICO_ERROR_TIMEOUT) {
+            // Last parameter key reached
+            return count;
+        }
+        if (count == ASCII_MAX_ASSIGNMENTS) {
+            return -1;
+        }
+        keys[count] = (char)read_char;
 
-    return (spacing << 12) | (length << 5) | repeats;
+        if (getchar_timeout_us(100000) != ' ') { // Separator between param_key and param_value (' ')
+            return -1;
+        }
+        if (!read_ascii_value(&values[count])) {
+            return -1;
+        }
+        count++;
+    }
 }
 
+#if defined(ENABLE_COMMAND_UART)
+uint8_t command_uart_ring[COMMAND_UART_RING_SIZE]; // Received bytes, written by command_uart_irq_handler()
+volatile uint32_t command_uart_head = 0; // Bytes received (free-running, the ring index is taken modulo its size)
+volatile uint32_t command_uart_tail = 0; // Bytes read by the command parser
+void (*command_uart_chars_available)(void *) = NULL; // stdio callback, see command_uart_set_chars_available_callback()
+void *command_uart_chars_available_param = NULL;
 
 /**
- * @brief Updates delay parameters and restarts the PIO state machine.
+ * @brief Moves the received bytes from the UART RX FIFO into the ring buffer (UART IRQ on core1).
  *
- * This function fully resets the specified PIO state machine, clears its FIFOs and OSR,
- * then pushes new combined timing parameters and multiple copies of the offset value
- * into the TX FIFO (often to be consumed by DMA or the PIO program). Finally, it
- * resets the program counter and restarts the state machine.
- *
- * @param pio       The PIO instance (pio0 or pio1).
- * @param sm        The state machine number (0–3).
- * @param offset    Offset value to be pushed multiple times into the FIFO.
- * @param length    Length parameter for timing configuration.
- * @param spacing   Spacing parameter for timing configuration.
- * @param repeats   Repeat count for timing configuration.
+ * Raised when the RX FIFO is half full or after 32 idle bit times with data in it, so the
+ * 32 byte FIFO cannot overflow while core1 spends time in a command. Bytes that do not fit
+ * into the ring are dropped (the frame CRC catches them).
  */
-void update_delay(PIO pio, uint sm, uint program_offset, uint32_t offset, uint length, uint spacing, uint repeats) {
-    // More thorough state machine reset
-    pio_sm_set_enabled(pio, sm, false);
-
-    // Clear both TX and RX FIFOs
-    pio_sm_clear_fifos(pio, sm);
-
-    // Reset the state machine to initial state
-    pio_sm_restart(pio, sm);
-
-    // Clear any stale data in OSR
-    pio_sm_exec(pio, sm, pio_encode_pull(false, false));
-    pio_sm_exec(pio, sm, pio_encode_out(pio_null, 32));
-
-    uint32_t combined = pack_combined_parameters(repeats, spacing, length); // Combine parameters into single word
-    pio_sm_put(pio, sm, combined); // Put combined parameters into FIFO
-    // Prefill FIFO with offset (continued automatically by DMA)
-    pio_sm_put(pio, sm, offset);
-    pio_sm_put(pio, sm, offset);
-    pio_sm_put(pio, sm, offset);
-    pio_sm_put(pio, sm, offset);
-    pio_sm_put(pio, sm, offset);
-    pio_sm_put(pio, sm, offset);
-    pio_sm_put(pio, sm, offset);
-
-    // Re-initialize the state machine's program counter
-    pio_sm_exec(pio, sm, pio_encode_jmp(program_offset));
-
-    // Restart the state machine
-    pio_sm_set_enabled(pio, sm, true);
+void command_uart_irq_handler(void) {
+    while (uart_is_readable(COMMAND_UART)) {
+        uint8_t c = (uint8_t)uart_getc(COMMAND_UART);
+        uint32_t head = command_uart_head;
+        if (head - command_uart_tail < COMMAND_UART_RING_SIZE) {
+            command_uart_ring[head % COMMAND_UART_RING_SIZE] = c;
+            command_uart_head = head + 1;
+        }
+    }
+    if (command_uart_chars_available) {
+        command_uart_chars_available(command_uart_chars_available_param);
+    }
 }
 
-void init_pulsegen_pio(PIO pio, uint sm, uint program_offset) {
-    // Configure pin directions
-    gpio_pull_down(TRIGGER_PIN);
-    pio_gpio_init(pio, TRIGGER_PIN);   // input trigger pin
-    pio_gpio_init(pio, PULSE_PIN);    // output trigger pin
-    gpio_set_drive_strength(PULSE_PIN, GPIO_DRIVE_STRENGTH_12MA);
-
-    // Set input and sideset bases
-    pio_sm_config c = pulsegen_program_get_default_config(program_offset);
-    // sm_config_set_in_pins(&c, TRIGGER_PIN);
-    // sm_config_set_out_pins(&c, PULSE_PIN, 1);
-    pio_sm_set_consecutive_pindirs(pio, sm, PULSE_PIN, 1, true);  // output pin
-    sm_config_set_sideset_pins(&c, PULSE_PIN);
-    sm_config_set_clkdiv(&c, 1.0f);  // Full speed: 125MHz (8ns per instr)
-
-    sm_config_set_fifo_join(&c, PIO_FIFO_JOIN_TX); // Join both FIFOs into one 8 word TX FIFO (cpu -> pio)
-
-    pio_sm_init(pio, sm, program_offset, &c); // Initialize state machine
+/**
+ * @brief stdio input of the command UART: takes bytes out of the ring buffer.
+ */
+int command_uart_in_chars(char *buf, int len) {
+    int count = 0;
+    while (count < len && command_uart_tail != command_uart_head) {
+        buf[count++] = (char)command_uart_ring[command_uart_tail % COMMAND_UART_RING_SIZE];
+        command_uart_tail++;
+    }
+    return count ? count : PICO_ERROR_NO_DATA;
 }
 
-void init_test_trigger_pio(PIO pio, uint sm, uint program_offset, uint32_t high_cycles, uint32_t low_cycles) {
-    pio_sm_config c = trigger_test_program_get_default_config(program_offset);
-
-    pio_sm_clear_fifos(pio, sm);
-    sm_config_set_clkdiv(&c, 200.0f);  // Full speed: 125MHz (8ns per instr)
-
-    pio_gpio_init(pio, TEST_PIN); // Init TEST_PIN GPIO
-
-    sm_config_set_set_pins(&c, TEST_PIN, 1); // Set output pin
-    pio_sm_set_consecutive_pindirs(pio, sm, TEST_PIN, 1, true);  // Set as output
-
-    pio_sm_init(pio, sm, program_offset, &c); // Initialize state machine
-
-    // Push high and low cycles
-    pio_sm_put(pio, sm, high_cycles);
-    pio_sm_put(pio, sm, low_cycles);
-
-    pio_sm_set_enabled(pio, sm, true); // Enable state machine
+/**
+ * @brief stdio output of the command UART (blocks only while the 32 byte TX FIFO is full).
+ */
+void command_uart_out_chars(const char *buf, int len) {
+    uart_write_blocking(COMMAND_UART, (const uint8_t *)buf, (size_t)len);
 }
 
-int main() {
-    // Pulse generator configuration parameters
-    uint32_t offset = 10;
-    unsigned int repeats = 2;
-    unsigned int length = 25;
-    unsigned int spacing = 20;
+/**
+ * @brief stdio chars available callback of the command UART, called from command_uart_irq_handler().
+ */
+void command_uart_set_chars_available_callback(void (*fn)(void *), void *param) {
+    command_uart_chars_available_param = param;
+    command_uart_chars_available = fn;
+}
 
-    stdio_init_all();
+stdio_driver_t command_uart_stdio = {
+    .out_chars = command_uart_out_chars,
+    .in_chars = command_uart_in_chars,
+    .set_chars_available_callback = command_uart_set_chars_available_callback,
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+    .crlf_enabled = PICO_STDIO_DEFAULT_CRLF // Same line endings as over USB
+#endif
+};
 
-    // Load PIO program
-    PIO pulsegen_pio = pio0;
-    uint pulsegen_program_offset = pio_add_program(pulsegen_pio, &pulsegen_program);
-    uint pulsegen_sm = 0;
+/**
+ * @brief Makes the hardware UART the stdio of the command parser (called on core1 instead of
+ *        stdio_init_all(), USB is not started).
+ *
+ * USB CDC hands every command and response over in 1 ms frames, the UART has no frame
+ * schedule: a binary frame is acknowledged a few µs after its last byte plus the time on the
+ * wire (3.3 µs per byte at 3 Mbaud). The RX interrupt runs on core1, core0 is not disturbed.
+ */
+void command_uart_init(void) {
+    uart_init(COMMAND_UART, COMMAND_UART_BAUD);
+    gpio_set_function(COMMAND_UART_TX_PIN, GPIO_FUNC_UART);
+    gpio_set_function(COMMAND_UART_RX_PIN, GPIO_FUNC_UART);
+    gpio_pull_up(COMMAND_UART_RX_PIN); // Idle level while no host is connected
+    uart_set_hw_flow(COMMAND_UART, false, false);
+    uart_set_format(COMMAND_UART, 8, 1, UART_PARITY_NONE);
+    uart_set_fifo_enabled(COMMAND_UART, true);
 
-    init_pulsegen_pio(pulsegen_pio, pulsegen_sm, pulsegen_program_offset);
+    irq_set_exclusive_handler(COMMAND_UART_IRQ, command_uart_irq_handler);
+    irq_set_enabled(COMMAND_UART_IRQ, true);
+    uart_set_irq_enables(COMMAND_UART, true, false); // RX FIFO level and RX timeout
+    stdio_set_driver_enabled(&command_uart_stdio, true);
+}
+#endif
 
+volatile bool command_input_pending = false; // Set by the stdio chars available callback, cleared by the parser
 
-    setup_dma(pulsegen_pio, pulsegen_sm, &offset);
-    update_delay(pulsegen_pio, pulsegen_sm, pulsegen_program_offset, offset, length, spacing, repeats);
+/**
+ * @brief stdio chars available callback (USB or UART interrupt on core1).
+ */
+void command_input_callback(void *param) {
+    (void)param;
+    command_input_pending = true;
+}
 
+/**
+ * @brief Sleeps until input arrives or a one-shot or clock report is due (called on core1).
+ *
+ * Woken by the stdio interrupts (input, and the USB stack's own 1 ms tick) and by the SEV of
+ * core0 for a fired shot (stats_dma_irq_handler()) or a lost target clock (clock_task()).
+ */
+void command_wait_event(void) {
+    if (!command_input_pending && !oneshot_report_pending() && !clock_report_pending()) {
+        __wfe();
+    }
+}
 
-    #if defined(ENABLE_TEST_PIN_PIO)
-        PIO test_pio = pio1;
-        uint test_program_offset = pio_add_program(test_pio, &trigger_test_program);
-        uint test_sm = 1;
-
-
-        init_test_trigger_pio(test_pio, test_sm, test_program_offset, TEST_PIN_HIGH_CYCLES - 2, TEST_PIN_LOW_CYCLES - 5);
-    #elif defined(ENABLE_TEST_PIN_LOOP)
-        gpio_init(TEST_PIN);
-        gpio_set_dir(TEST_PIN, GPIO_OUT);
-
-        while (true) {
-            gpio_put(TEST_PIN, 1);  // Turn LED ON
-            __asm__ __volatile__ (
-    ".rept 200\n\t"
-    "nop\n\t"
-    ".endr\n\t"
-);
-            // sleep_us(1);         // Delay 500 ms
-            gpio_put(TEST_PIN, 0);  // Turn LED OFF
-            __asm__ __volatile__ (
-    ".rept 200\n\t"
-    "nop\n\t"
-    ".endr\n\t"
-);
-
-            // sleep_us(2);         // Delay 500 ms
-        }
+/**
+ * @brief Entry of core1: USB stdio (or the command UART) and the ASCII/binary command parser.
+ *
+ * Parameter changes are handed to core0 with control_call(), so core0 and its bus accesses
+ * are not disturbed by USB interrupts or polling.
+ */
+void command_core_main(void) {
+    #if defined(ENABLE_COMMAND_UART)
+        command_uart_init();
+    #else
+        stdio_init_all();
     #endif
+    latency_init(); // SysTick of core1 times the SET frames
+    stdio_set_chars_available_callback(command_input_callback, NULL);
 
     typedef enum {
         CMD_GET = 0,
-        CMD_SET = 1
+        CMD_SET = 1,
+        CMD_CLOCK = 2,
+        CMD_SELFTEST = 3,
+        CMD_STIMULUS = 4,
+        CMD_QUALIFIER = 5,
+        CMD_ARM = 6,
+        CMD_PRESET = 7,
+        CMD_EXT_CLOCK = 8
     } CommandType;
 
     CommandType command;
     int read_char;
     char param_key;
     bool comm_error = false;
-    int separator_detected = false;
-    char val_buf[12];
 
     while (1) {
         if (comm_error) {
             printf("   NOK\n");
-            // Flush RX Buffer (optional)
-            while (uart_is_readable(uart0)) {
-                (void)uart_getc(uart0);  // discard character
+            // Drop the rest of the rejected command (from whichever stdio transport is used)
+            while (getchar_timeout_us(0) != PICO_ERROR_TIMEOUT) {
             }
-
         }
         comm_error = false;
-        read_char = getchar_timeout_us(0);  // wait up to 100ms for first char ('G' or 'S')
-        if (read_char == PICO_ERROR_TIMEOUT) { // No UART input, do other stuff
-            tight_loop_contents();
-            // Currently no incoming UART command, put other looping code here (TODO: for future functionality in main loop)
+        oneshot_report();
+        clock_report();
+        command_input_pending = false; // Input from here on is seen by command_wait_event()
+        read_char = getchar_timeout_us(0);  // First char ('G' or 'S'), the rest of a command is waited for
+        if (read_char == PICO_ERROR_TIMEOUT) { // No input
+            command_wait_event();
             continue;
         }
         else if ((char)read_char == 'G') {
@@ -275,12 +3756,61 @@ int main() {
         else if (read_char == 'S') {
             command = CMD_SET;
         }
+        else if (read_char == 'C') {
+            command = CMD_CLOCK;
+        }
+        else if (read_char == 'T') {
+            command = CMD_SELFTEST;
+        }
+        else if (read_char == 'E') {
+            command = CMD_STIMULUS;
+        }
+        else if (read_char == 'Q') {
+            command = CMD_QUALIFIER;
+        }
+        else if (read_char == 'A') {
+            command = CMD_ARM;
+        }
+        else if (read_char == 'P') {
+            command = CMD_PRESET;
+        }
+        else if (read_char == 'X') {
+            command = CMD_EXT_CLOCK;
+        }
+        else if (read_char >= PRESET_SELECT_BYTE && read_char < PRESET_SELECT_BYTE + (int)PRESET_COUNT) {
+            // Single-byte preset switch, answered with a single byte as soon as the preset is staged
+            bool switched = preset_command('p', (uint32_t)(read_char - PRESET_SELECT_BYTE)) == FRAME_STATUS_OK;
+            putchar_raw(switched ? read_char : PRESET_NAK);
+            stdio_flush();
+            continue;
+        }
+        else if (read_char == 'W') {
+            // Save the configuration to flash, no arguments (answered right away)
+            uint8_t status = save_command();
+            if (status != FRAME_STATUS_OK) {
+                printf(status == FRAME_STATUS_MODE ? "MODE" : "FLASH");
+                comm_error = true;
+                continue;
+            }
+            printf("OK\n");
+            continue;
+        }
+        else if (read_char == FRAME_SYNC || read_char == FRAME_SYNC_TAGGED) {
+            handle_frame(channel_params, read_char == FRAME_SYNC_TAGGED);
+            frame_tag = -1; // FIRED notifications are untagged
+            continue;
+        }
         else {
             comm_error = true;
             continue;
         }
 
         read_char = getchar_timeout_us(100000);
+        uint channel = 0;
+        if (read_char >= '0' && read_char < '0' + NUM_CHANNELS) { // Optional channel digit (e.g. "S2 o 150")
+            channel = (uint)(read_char - '0');
+            read_char = getchar_timeout_us(100000);
+        }
         if (read_char != ' ') {// Command has to be followed by a space
             printf("TIMEOUT");
             comm_error = true;
@@ -295,121 +3825,310 @@ int main() {
                 comm_error = true;
                 continue;
             }
-            if (param_key == 'o') { // offset
-                printf("%u\n", offset);
-            } else if (param_key == 'l') { // length
-                printf("%u\n", length);
-            } else if (param_key == 's') { // spacing
-                printf("%u\n", spacing);
-            } else if (param_key == 'r') { // repeats
-                printf("%u\n", repeats);
-            } else {
+            uint32_t value;
+            if (!get_channel_value(channel_params, channel, param_key, &value)) {
                 comm_error = true;
                 continue;
             }
+            printf("%u\n", value);
         }
         // SET command
         else if (command == CMD_SET) {
-            // Copy current values
-            uint32_t new_offset  = offset;
-            uint32_t new_length  = length;
-            uint32_t new_spacing = spacing;
-            uint32_t new_repeats = repeats;
-            while (1) {
-                // Get parameter key
-                read_char = getchar_timeout_us(100000);
-                param_key = (char)read_char;
-                if (read_char == PICO_ERROR_TIMEOUT) {
-                    // Last parameter key reached -> break
-                    break;
-                }
-
-                if (getchar_timeout_us(100000) != ' ') { // Separator between param_key and param_value (' ')
+            if (channel == 0 && preset_gpio) { // The select pins own channel 0
+                printf("MODE");
+                comm_error = true;
+                continue;
+            }
+            pulse_params_t new_params = channel_params[channel]; // Copy current values
+            char keys[ASCII_MAX_ASSIGNMENTS];
+            uint32_t values[ASCII_MAX_ASSIGNMENTS];
+            int count = read_ascii_assignments(keys, values);
+            for (int i = 0; i < count; i++) {
+                uint32_t *param = param_by_key(&new_params, keys[i]);
+                if (param == NULL) {
                     comm_error = true;
                     break;
                 }
+                *param = values[i];
+            }
+            if (count < 0 || comm_error) {
+                comm_error = true;
+                continue;
+            }
 
-                // Read parameter
-                if (param_key == 'o' || param_key == 'l' || param_key == 's' || param_key == 'r') {
-                    separator_detected = false;
-                    memset(val_buf, 0, sizeof(val_buf)); // Zeroize value buffer
-                    // Read value
-                    for (size_t i = 0; i < 12; i++)
-                    {
-                        read_char = getchar_timeout_us(900000);
-                        if (read_char == PICO_ERROR_TIMEOUT) {
-                            // End of command (end of last value)
-                            separator_detected = true;
-                            break;
-                        }
-                        else if (read_char == ' ') { // Space detected (end of parameter value)
-                            separator_detected = true;
-                            break;
-                        }
-                        else { // Add character to buffer it is a digit
-                            if (isdigit((char)read_char)) {
-                                val_buf[i] = (char)read_char;
-                            }
-                            else {
-                                comm_error = true;
-                                break;
-                            }
-                        }
-                    }
-                    if (separator_detected != true) { // Make sure that a separation char was received (passed number fits into bounds)
-                        comm_error = true;
-                    }
-                    if (comm_error) {
-                        break;
-                    }
-
-                    uint32_t val_num = (uint32_t)strtoul(val_buf, NULL, 10); // Convert string buffer to number
-                    // Store parameter value into variable
-                    switch (param_key) {
-                        case 'o': new_offset = val_num; break;
-                        case 'l': new_length = val_num; break;
-                        case 's': new_spacing = val_num; break;
-                        case 'r': new_repeats = val_num; break;
-                        default: {
-                            comm_error = true;
-                            break;
-                        }
-                    }
+            // Commit all new values and update PIO
+            char invalid_key = check_channel_params(channel, &new_params);
+            if (invalid_key) {
+                print_param_error(invalid_key, &new_params, channel_variant(channel, &new_params));
+                comm_error = true;
+                continue;
+            }
+            quantize_spacing(&new_params, channel_variant(channel, &new_params));
+
+            channel_params[channel] = new_params;
+            control_call(CONTROL_APPLY, channel, 0);
+            printf("OK\n");
+        }
+        // CLOCK command: system clock in kHz (e.g. "C 250000"), read back with "G f" (Hz)
+        else if (command == CMD_CLOCK) {
+            uint32_t khz;
+            if (!read_ascii_value(&khz)) {
+                comm_error = true;
+                continue;
+            }
+            if (!control_call(CONTROL_CLOCK, 0, khz)) {
+                printf("clock=%u-%u", SYS_CLOCK_MIN_KHZ, SYS_CLOCK_MAX_KHZ);
+                comm_error = true;
+                continue;
+            }
+            printf("OK\n");
+        }
+        // EXT_CLOCK command: run from the target clock at EXT_CLOCK_PIN, its frequency in kHz
+        // (e.g. "X 24000"), back to the internal clock with "C"
+        else if (command == CMD_EXT_CLOCK) {
+            uint32_t khz;
+            if (!read_ascii_value(&khz)) {
+                comm_error = true;
+                continue;
+            }
+            clock_frames = false;
+            if (!control_call(CONTROL_EXT_CLOCK, 0, khz)) {
+                printf("clock=%u-%u", EXT_CLOCK_MIN_KHZ, EXT_CLOCK_MAX_KHZ);
+                comm_error = true;
+                continue;
+            }
+            printf("OK\n");
+        }
+        // SELFTEST command: trigger-to-pulse latency over n shots (e.g. "T 1000" or "T1 1000")
+        else if (command == CMD_SELFTEST) {
+            uint32_t shots;
+            if (!read_ascii_value(&shots) || shots < 1 || shots > SELFTEST_MAX_SHOTS) {
+                printf("n=1-%u", SELFTEST_MAX_SHOTS);
+                comm_error = true;
+                continue;
+            }
+            if (!control_call(CONTROL_SELFTEST, channel, shots)) {
+                printf("MODE");
+                comm_error = true;
+                continue;
+            }
+            const selftest_result_t *r = &selftest_result;
+            printf("shots=%u misses=%u min=%u max=%u mean=%u.%03u hist=%u:", r->shots, r->misses, r->min, r->max,
+                   r->mean_milli / 1000, r->mean_milli % 1000, r->hist_base);
+            for (uint i = 0; i < SELFTEST_HIST_BINS; i++) {
+                printf("%s%u", i ? "," : "", r->hist[i]);
+            }
+            printf("\n");
+        }
+        // STIMULUS command: square wave on TEST_PIN, high/low time in cycles and number of pulses
+        // (0 = continuous), e.g. "E h 100 l 900 n 0". "E h 0" turns the generator off.
+        else if (command == CMD_STIMULUS) {
+            stimulus_params_t new_stimulus = stimulus_params;
+            new_stimulus.len = 1; // Square wave from the first pulse of the current pattern
+            char keys[ASCII_MAX_ASSIGNMENTS];
+            uint32_t values[ASCII_MAX_ASSIGNMENTS];
+            int count = read_ascii_assignments(keys, values);
+            for (int i = 0; i < count && !comm_error; i++) {
+                switch (keys[i]) {
+                    case 'h': new_stimulus.pulses[0][0] = values[i]; break;
+                    case 'l': new_stimulus.pulses[0][1] = values[i]; break;
+                    case 'n': new_stimulus.repeats = values[i]; break;
+                    default: comm_error = true; break;
                 }
-                else {
-                    comm_error = true;
+            }
+            if (count < 0 || comm_error) {
+                comm_error = true;
+                continue;
+            }
+            if (new_stimulus.pulses[0][0] == 0) {
+                new_stimulus.len = 0;
+            }
+            if (!check_stimulus(&new_stimulus)) {
+                printf("h,l=%u-%u n<=%u", STIMULUS_MIN_CYCLES, STIMULUS_MAX_CYCLES, STIMULUS_MAX_PULSES);
+                comm_error = true;
+                continue;
+            }
+            stimulus_params_t previous = stimulus_params;
+            stimulus_params = new_stimulus;
+            if (!control_call(CONTROL_STIMULUS, 0, 0)) {
+                stimulus_params = previous;
+                printf("MODE");
+                comm_error = true;
+                continue;
+            }
+            printf("OK\n");
+        }
+        // QUALIFIER command: skip count and width filter of the trigger in cycles, e.g. "Q k 9 q 10"
+        // (every 10th edge that is high for 10 cycles). "Q k 0 q 0" passes every edge again.
+        // "Q x 165 n 8 b 100" triggers on the samples 10100101 taken every 100 cycles, "Q n 0"
+        // goes back to the edge trigger.
+        else if (command == CMD_QUALIFIER) {
+            qualifier_params_t new_qualifier = qualifier_params;
+            char keys[ASCII_MAX_ASSIGNMENTS];
+            uint32_t values[ASCII_MAX_ASSIGNMENTS];
+            int count = read_ascii_assignments(keys, values);
+            for (int i = 0; i < count && !comm_error; i++) {
+                switch (keys[i]) {
+                    case 'k': new_qualifier.skip = values[i]; break;
+                    case 'q': new_qualifier.width = values[i]; break;
+                    case 'x': new_qualifier.pattern = values[i]; break;
+                    case 'n': new_qualifier.pattern_bits = values[i]; break;
+                    case 'b': new_qualifier.pattern_period = values[i]; break;
+                    default: comm_error = true; break;
                 }
-                if (comm_error) {
-                    break;
+            }
+            if (count < 0 || comm_error) {
+                comm_error = true;
+                continue;
+            }
+            char invalid_key = check_qualifier(&new_qualifier);
+            if (invalid_key) {
+                switch (invalid_key) {
+                    case 'q': printf("q<=%u", QUALIFIER_MAX_WIDTH); break;
+                    case 'n': printf("n<=%u", PATTERN_MAX_BITS); break;
+                    case 'x': printf("x<2^n"); break;
+                    case 'b': printf("b=%u-%u", PATTERN_MIN_PERIOD, PATTERN_MAX_PERIOD); break;
+                    default: printf("k=0 q=0 with n"); break;
                 }
+                comm_error = true;
+                continue;
             }
-            if (comm_error) {
+            qualifier_params_t previous = qualifier_params;
+            qualifier_params = new_qualifier;
+            if (!control_call(CONTROL_QUALIFIER, 0, 0)) {
+                qualifier_params = previous;
+                printf("MODE");
+                comm_error = true;
                 continue;
             }
-
-            // Commit all new values and update PIO
-            if (new_offset < 2) {
-                printf("min_offset=2");
+            printf("OK\n");
+        }
+        // ARM command: "A 1" arms a single shot of channel 0, "A 0" leaves one-shot mode. Answered
+        // with the sequence number of the shot ("OK 7"), `FIRED 7` follows once it fired.
+        else if (command == CMD_ARM) {
+            uint32_t arm;
+            if (!read_ascii_value(&arm) || arm > 1) {
                 comm_error = true;
                 continue;
             }
-            if (new_length < 1) {
-                printf("min_length=1");
+            if (!control_call(CONTROL_ARM, 0, arm)) {
+                printf("MODE");
                 comm_error = true;
                 continue;
             }
-            if (new_spacing < 6) {
-                printf("min_spacing=6");
+            oneshot_frames = false;
+            printf("OK %u\n", oneshot_seq);
+        }
+        // PRESET command: "P s 2" stores the parameters of channel 0 as preset 2, "P p 2" switches
+        // to it, "P g 1" lets the select pins pick the preset ("P g 0" returns channel 0 to the host)
+        else if (command == CMD_PRESET) {
+            char keys[ASCII_MAX_ASSIGNMENTS];
+            uint32_t values[ASCII_MAX_ASSIGNMENTS];
+            int count = read_ascii_assignments(keys, values);
+            uint8_t status = (count < 0) ? FRAME_STATUS_PARAM : FRAME_STATUS_OK;
+            for (int i = 0; i < count && status == FRAME_STATUS_OK; i++) {
+                status = preset_command(keys[i], values[i]);
+            }
+            if (status == FRAME_STATUS_RANGE) {
+                printf("preset=0-%u", PRESET_COUNT - 1);
+            }
+            else if (status == FRAME_STATUS_MODE) {
+                printf("MODE");
+            }
+            if (status != FRAME_STATUS_OK) {
                 comm_error = true;
                 continue;
             }
-
-            offset = new_offset;
-            length = new_length;
-            spacing = new_spacing;
-            repeats = new_repeats;
-            update_delay(pulsegen_pio, pulsegen_sm, pulsegen_program_offset, offset - 2, length - 1, spacing - 6, repeats);
             printf("OK\n");
         }
     }
 }
+
+int main() {
+    // Pulse generator configuration parameters (per channel)
+    for (uint i = 0; i < NUM_CHANNELS; i++) {
+        channel_params[i] = (pulse_params_t){
+            .offset = 10,
+            .length = 25,
+            .spacing = 20,
+            .repeats = 2,
+            .cooldown = DEFAULT_COOLDOWN,
+            .prescaler = 1
+        };
+    }
+
+    config_load(); // Saved configuration, staged below before USB comes up
+    latency_init(); // SysTick of core0 times the parameter updates
+    latency_reset(&apply_latency);
+    latency_reset(&frame_latency);
+
+    // Load PIO program
+    static pulsegen_t pulsegen;
+    pulsegen.pio = pio0;
+    pulsegen.sm = 0;
+    pulsegen.pin = PULSE_PIN;
+
+    pulsegen.prescaler = effective_prescaler(&channel_params[0], select_variant(&channel_params[0]));
+    pulsegen_load(&pulsegen, select_variant(&channel_params[0]));
+
+
+    param_feed_init(&pulsegen.feed, pulsegen.pio, pulsegen.sm, FEED_UNIFORM_WORDS);
+    apply_params(&pulsegen, &channel_params[0]); // Stage initial parameters (requested once the SM is enabled)
+
+    // Additional channels: free SMs of pio1, then the remaining SMs of pio0 (same program as channel 0)
+    static pulse_channel_t channels[NUM_CHANNELS > 1 ? NUM_CHANNELS - 1 : 1];
+    const uint channel_pins[] = CHANNEL_PINS;
+    uint sm_mask[2] = { 1u << pulsegen.sm, 0 }; // SMs to enable per PIO block
+    if (NUM_CHANNELS > 1) {
+        uint pio1_program_offset = pio_add_program(pio1, &pulsegen_program);
+        for (uint i = 1; i < NUM_CHANNELS; i++) {
+            PIO pio = channel_pio(i);
+            uint32_t set[FEED_UNIFORM_WORDS];
+            params_to_set(&channel_params[i], set);
+            channel_init(&channels[i - 1], i, (pio == pio1) ? pio1_program_offset : pulsegen.program_offset,
+                         channel_pins[i], set);
+            sm_mask[pio_get_index(pio)] |= 1u << channel_sm(i);
+        }
+    }
+    stats_init(pulsegen.feed.req_chan);
+
+    #if defined(ENABLE_TEST_PIN_PIO)
+        // Loaded before the qualifier, which keeps the free instruction memory next to it for
+        // its larger programs (see qualifier_apply())
+        uint test_program_offset = pio_add_program(pio1, &trigger_test_program);
+    #endif
+
+    // Start all channels of a PIO block on the same cycle. The channels wait for the IRQ of their
+    // block's qualifier, both qualifiers see the trigger edge on the same cycle, so the skew
+    // between blocks enabled one after the other does not matter.
+    qualifier.used[0] = true;
+    qualifier.used[1] = sm_mask[1] != 0;
+    qualifier_load(&qualifier, &qualifier_params); // Every edge until the host sets a qualification
+    qualifier_enable(&qualifier);
+    pio_enable_sm_mask_in_sync(pio0, sm_mask[0]);
+    if (sm_mask[1]) {
+        pio_enable_sm_mask_in_sync(pio1, sm_mask[1]);
+    }
+
+    #if defined(ENABLE_TEST_PIN_PIO)
+        stimulus_params.pulses[0][0] = TEST_PIN_HIGH_CYCLES;
+        stimulus_params.pulses[0][1] = TEST_PIN_LOW_CYCLES;
+        stimulus_params.len = 1; // Continuous square wave until the host loads another pattern
+        stimulus_init(&stimulus, pio1, TEST_SM, test_program_offset, &stimulus_params);
+    #endif
+
+    multicore_launch_core1_with_stack(command_core_main, command_core_stack, sizeof(command_core_stack));
+
+    // core0 only serves the PIO/DMA control path, commands arrive from core1. It sleeps between
+    // events, so the DMA and the PIO FIFOs see no bus traffic of an idle core.
+    while (1) {
+        control_task(&pulsegen, channels);
+        clock_task();
+        sweep_task(&pulsegen);
+        preset_task(&pulsegen);
+        for (uint i = 1; i < NUM_CHANNELS; i++) {
+            channel_task(&channels[i - 1]);
+        }
+        core0_wait_event(channels);
+    }
+}
@@ -20,5 +20,5 @@ try:
 
 except serial.SerialException as e:
     print(f"Serial error: {e}")
-except ValueError as e:
+except (ValueError, RuntimeError) as e:
     print(f"Communication error: {e}")
\ No newline at end of file